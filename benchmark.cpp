@@ -0,0 +1,221 @@
+/**
+ * Benchmark runner for all three programs.
+ *
+ * Runs each program's own benchmark mode from the directory the runner
+ * lives in, gathers their JSON records into one array, and compares every
+ * result against a stored baseline so that regressions are flagged
+ * automatically.  The comparison is on each benchmark's fastest repetition,
+ * which is the least noisy of the times recorded.
+ */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "timing.h"
+
+using namespace std;
+
+#ifndef BENCH_BASELINE
+#define BENCH_BASELINE "bench_baseline.json"
+#endif
+
+const char* PROGRAMS[][2] =
+{
+	{"nqueens", "bench"},
+	{"dijkstra", "bench"},
+	{"sudoku", "bench --json"}
+};
+const int NUM_PROGRAMS = sizeof(PROGRAMS) / sizeof(PROGRAMS[0]);
+const double DEFAULT_THRESHOLD = 0.25;
+
+/**
+ * Returns the string value of key in a one-line JSON record, or an empty
+ * string if it isn't there.
+ */
+string jsonString(const string& record, const char* key)
+{
+	string pattern = string("\"") + key + "\": \"";
+	size_t start = record.find(pattern);
+	if (start == string::npos)
+		return "";
+	start += pattern.size();
+	size_t end = record.find('"', start);
+	return (end == string::npos) ? "" : record.substr(start, end - start);
+}
+
+// Returns the number value of key in a record, or -1 if it's missing or null.
+double jsonNumber(const string& record, const char* key)
+{
+	string pattern = string("\"") + key + "\": ";
+	size_t start = record.find(pattern);
+	if (start == string::npos)
+		return -1;
+	const char* value = record.c_str() + start + pattern.size();
+	char* end;
+	double number = strtod(value, &end);
+	return (end == value) ? -1 : number;
+}
+
+// Returns the key a record is matched against the baseline by.
+string recordKey(const string& record)
+{
+	return jsonString(record, "program") + "/" + jsonString(record, "name");
+}
+
+/**
+ * Reads the records, one per line, from a file written by the programs or
+ * by this runner.  Returns false if it can't be opened.
+ */
+bool readRecords(FILE* in, vector<string>& records)
+{
+	if (in == 0)
+		return false;
+	char* line = 0;
+	size_t capacity = 0;
+	ssize_t length;
+	while ((length = getline(&line, &capacity, in)) >= 0)
+	{
+		string record(line, length);
+		while (!record.empty() && (record[record.size() - 1] == '\n' || record[record.size() - 1] == ',' || record[record.size() - 1] == '\r'))
+			record.erase(record.size() - 1);
+		if (!record.empty() && record[0] == '{')
+			records.push_back(record);
+	}
+	free(line);
+	return true;
+}
+
+void writeRecords(FILE* out, const vector<string>& records)
+{
+	fprintf(out, "[\n");
+	for (size_t i = 0; i < records.size(); i++)
+		fprintf(out, "%s%s\n", records[i].c_str(), (i + 1 < records.size()) ? "," : "");
+	fprintf(out, "]\n");
+}
+
+void printUsage()
+{
+	cout << "Usage:" << endl;
+	cout << "benchmark [-b baseline] [-t threshold] [-o output] [-u]" << endl;
+	cout << "to run every program's benchmarks and print the results as JSON, or" << endl;
+	cout << "write them to output.  Each result is compared with the baseline" << endl;
+	cout << "(default " << BENCH_BASELINE << "), and anything slower by more than" << endl;
+	cout << "threshold (default " << DEFAULT_THRESHOLD << ", a fraction) is flagged as a" << endl;
+	cout << "regression.  -u replaces the baseline with the new results.  Times" << endl;
+	cout << "only compare on one machine, so record a baseline on each." << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* baselineName = BENCH_BASELINE;
+	const char* outputName = 0;
+	double threshold = DEFAULT_THRESHOLD;
+	bool update = false;
+	for (int a = 1; a < argc; a++)
+	{
+		if (strcmp(argv[a], "-b") == 0 && a + 1 < argc)
+			baselineName = argv[++a];
+		else if (strcmp(argv[a], "-t") == 0 && a + 1 < argc)
+			threshold = atof(argv[++a]);
+		else if (strcmp(argv[a], "-o") == 0 && a + 1 < argc)
+			outputName = argv[++a];
+		else if (strcmp(argv[a], "-u") == 0)
+			update = true;
+		else
+		{
+			printUsage();
+			return -1;
+		}
+	}
+
+	// the programs are built next to the runner.
+	string directory = argv[0];
+	size_t slash = directory.rfind('/');
+	directory = (slash == string::npos) ? "." : directory.substr(0, slash);
+
+	vector<string> records;
+	double start = monotonicSeconds();
+	for (int p = 0; p < NUM_PROGRAMS; p++)
+	{
+		string command = directory + "/" + PROGRAMS[p][0] + " " + PROGRAMS[p][1];
+		cerr << "Running " << command << endl;
+		FILE* in = popen(command.c_str(), "r");
+		size_t before = records.size();
+		if (!readRecords(in, records) || pclose(in) != 0 || records.size() == before)
+		{
+			cerr << "Benchmark " << PROGRAMS[p][0] << " failed." << endl;
+			return -1;
+		}
+	}
+	cerr << "Ran " << records.size() << " benchmarks in " << monotonicSeconds() - start << " seconds." << endl;
+
+	FILE* out = (outputName == 0) ? stdout : fopen(outputName, "w");
+	if (out == 0)
+	{
+		cerr << "Can't write " << outputName << endl;
+		return -1;
+	}
+	writeRecords(out, records);
+	if (out != stdout)
+		fclose(out);
+
+	vector<string> baseline;
+	FILE* in = fopen(baselineName, "r");
+	int regressions = 0;
+	if (readRecords(in, baseline))
+	{
+		fclose(in);
+		map<string, double> baselineTimes;
+		for (size_t i = 0; i < baseline.size(); i++)
+			baselineTimes[recordKey(baseline[i])] = jsonNumber(baseline[i], "min_ns");
+
+		fprintf(stderr, "%-22s %14s %14s %8s\n", "benchmark", "baseline ns", "current ns", "change");
+		for (size_t i = 0; i < records.size(); i++)
+		{
+			string key = recordKey(records[i]);
+			double now = jsonNumber(records[i], "min_ns");
+			map<string, double>::iterator b = baselineTimes.find(key);
+			if (b == baselineTimes.end() || b->second <= 0)
+			{
+				fprintf(stderr, "%-22s %14s %14.0f %8s  new\n", key.c_str(), "-", now, "-");
+				continue;
+			}
+			double change = now / b->second - 1;
+			const char* flag = "";
+			if (change > threshold)
+			{
+				flag = "  REGRESSION";
+				regressions++;
+			}else if (change < -threshold)
+			{
+				flag = "  faster";
+			}
+			fprintf(stderr, "%-22s %14.0f %14.0f %+7.1f%%%s\n", key.c_str(), b->second, now, change * 100, flag);
+		}
+		if (regressions > 0)
+			cerr << regressions << " regressions against " << baselineName << "." << endl;
+	}else if (!update)
+	{
+		cerr << "No baseline at " << baselineName << "; run with -u to record one." << endl;
+	}
+
+	if (update)
+	{
+		FILE* b = fopen(baselineName, "w");
+		if (b == 0)
+		{
+			cerr << "Can't write " << baselineName << endl;
+			return -1;
+		}
+		writeRecords(b, records);
+		fclose(b);
+		cerr << "Baseline written to " << baselineName << "." << endl;
+		return 0;
+	}
+	return (regressions > 0) ? 1 : 0;
+}
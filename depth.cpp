@@ -10,7 +10,16 @@
 
 #include <iostream>
 #include <cstdlib>
-#include <ctime>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "timing.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 int BOARD_SIZE;
 const int SOLUTION_SIZE = 400;
@@ -183,6 +192,420 @@ void findSolutions(int depth)
 	}
 }
 
+/**
+ * Bitmask engines.
+ *
+ * Instead of scanning the board, these place exactly one queen per row, top
+ * to bottom, and keep the columns and both diagonals attacked in the next row
+ * as three bitmasks.  The first PREFIX_DEPTH rows are enumerated up front into
+ * a queue of independent prefixes, and each prefix is then searched to the
+ * bottom of the board, either one at a time by the scalar engine or many at a
+ * time in SIMD lanes by the lockstep engine.
+ */
+const int MAX_BOARD_SIZE = 20;
+const int PREFIX_DEPTH = 3;
+
+struct Prefix
+{
+	uint32_t cols, left, right;
+	int depth;
+	int queens[MAX_BOARD_SIZE];
+};
+
+uint32_t fullMask;
+vector<Prefix> prefixes;
+size_t nextPrefix;
+
+/**
+ * Counts a solution given as the column of the queen in each row, and keeps
+ * a copy of the board if there's still room in the solution list.
+ */
+void recordSolution(const int* queens)
+{
+	if (num_solutions < SOLUTION_SIZE)
+	{
+		solutions[num_solutions] = new int*[BOARD_SIZE];
+		for (int y = 0; y < BOARD_SIZE; y++)
+		{
+			solutions[num_solutions][y] = new int[BOARD_SIZE];
+			for (int x = 0; x < BOARD_SIZE; x++)
+			{
+				solutions[num_solutions][y][x] = (queens[y] == x) ? 1 : 0;
+			}
+		}
+	}
+	num_solutions++;
+}
+
+/**
+ * Fills the prefix queue with every valid placement of the first PREFIX_DEPTH
+ * rows.
+ */
+void buildPrefixes(int depth, uint32_t cols, uint32_t left, uint32_t right, int* queens)
+{
+	if (depth == PREFIX_DEPTH || depth == BOARD_SIZE)
+	{
+		Prefix p;
+		p.cols = cols;
+		p.left = left;
+		p.right = right;
+		p.depth = depth;
+		memcpy(p.queens, queens, sizeof(p.queens));
+		prefixes.push_back(p);
+		return;
+	}
+
+	uint32_t avail = fullMask & ~(cols | left | right);
+	while (avail != 0)
+	{
+		uint32_t bit = avail & (0u - avail);
+		avail ^= bit;
+		queens[depth] = __builtin_ctz(bit);
+		buildPrefixes(depth + 1, cols | bit, ((left | bit) << 1) & fullMask, (right | bit) >> 1, queens);
+	}
+}
+
+/**
+ * Plain recursive bitmask search below a prefix.
+ */
+void searchBitmask(int depth, uint32_t cols, uint32_t left, uint32_t right, int* queens)
+{
+	if (depth == BOARD_SIZE)
+	{
+		recordSolution(queens);
+		return;
+	}
+
+	uint32_t avail = fullMask & ~(cols | left | right);
+	while (avail != 0)
+	{
+		uint32_t bit = avail & (0u - avail);
+		avail ^= bit;
+		queens[depth] = __builtin_ctz(bit);
+		searchBitmask(depth + 1, cols | bit, ((left | bit) << 1) & fullMask, (right | bit) >> 1, queens);
+	}
+}
+
+/**
+ * Scalar engine: works through the prefix queue one prefix at a time.  This
+ * is also the fallback when the CPU has no usable vector unit.
+ */
+void findSolutionsBitmask()
+{
+	for (nextPrefix = 0; nextPrefix < prefixes.size(); nextPrefix++)
+	{
+		Prefix& p = prefixes[nextPrefix];
+		searchBitmask(p.depth, p.cols, p.left, p.right, p.queens);
+	}
+}
+
+/**
+ * Per-lane state of the lockstep engine.  Every lane runs its own depth-first
+ * search with an explicit stack; the stacks are laid out [depth][lane] so a
+ * vector of per-lane depths can be turned into gather/scatter indices.
+ */
+template <int LANES>
+struct LockstepState
+{
+	uint32_t stackAvail[MAX_BOARD_SIZE + 1][LANES];
+	uint32_t stackCols[MAX_BOARD_SIZE + 1][LANES];
+	uint32_t stackLeft[MAX_BOARD_SIZE + 1][LANES];
+	uint32_t stackRight[MAX_BOARD_SIZE + 1][LANES];
+	int32_t depth[LANES];
+	int32_t base[LANES];
+	int32_t active[LANES];
+	uint32_t avail[LANES];
+	uint32_t cols[LANES];
+	uint32_t left[LANES];
+	uint32_t right[LANES];
+	int queens[LANES][MAX_BOARD_SIZE];
+};
+
+/**
+ * Hands the next prefix in the queue to each lane in the bitmask, or parks
+ * the lane for good once the queue is empty.
+ */
+template <int LANES>
+void refillLanes(LockstepState<LANES>& s, uint32_t lanes)
+{
+	while (lanes != 0)
+	{
+		int l = __builtin_ctz(lanes);
+		lanes &= lanes - 1;
+
+		// a prefix that is already a full board never reaches a lane.
+		while (nextPrefix < prefixes.size() && prefixes[nextPrefix].depth == BOARD_SIZE)
+		{
+			recordSolution(prefixes[nextPrefix].queens);
+			nextPrefix++;
+		}
+
+		if (nextPrefix == prefixes.size())
+		{
+			s.active[l] = 0;
+			s.avail[l] = 0;
+			s.depth[l] = 0;
+			s.base[l] = 0;
+			continue;
+		}
+
+		Prefix& p = prefixes[nextPrefix++];
+		s.active[l] = -1;
+		s.depth[l] = p.depth;
+		s.base[l] = p.depth;
+		s.cols[l] = p.cols;
+		s.left[l] = p.left;
+		s.right[l] = p.right;
+		s.avail[l] = fullMask & ~(p.cols | p.left | p.right);
+		memcpy(s.queens[l], p.queens, sizeof(s.queens[l]));
+	}
+}
+
+/**
+ * Records the boards of the lanes in the bitmask, all of which have just
+ * placed their last queen.  The queen in each searched row is the one bit
+ * that differs between the column masks on either side of it on the stack.
+ */
+template <int LANES>
+void recordLaneSolutions(LockstepState<LANES>& s, uint32_t lanes)
+{
+	while (lanes != 0)
+	{
+		int l = __builtin_ctz(lanes);
+		lanes &= lanes - 1;
+
+		for (int y = s.base[l]; y < BOARD_SIZE; y++)
+		{
+			uint32_t after = (y + 1 < BOARD_SIZE) ? s.stackCols[y + 1][l] : s.cols[l];
+			s.queens[l][y] = __builtin_ctz(after ^ s.stackCols[y][l]);
+		}
+		recordSolution(s.queens[l]);
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * Lockstep engine, 8 lanes of AVX2.  Each step every active lane either
+ * places its next queen (pushing its state) or backtracks one row (popping
+ * it).  AVX2 can gather but not scatter, so the pushes go out one lane at a
+ * time.
+ */
+__attribute__((target("avx2")))
+void findSolutionsAVX2()
+{
+	LockstepState<8>* s = new LockstepState<8>();
+	refillLanes(*s, 0xFF);
+
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i full = _mm256_set1_epi32(fullMask);
+	const __m256i size = _mm256_set1_epi32(BOARD_SIZE);
+	const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	__m256i avail = _mm256_loadu_si256((__m256i*)s->avail);
+	__m256i cols = _mm256_loadu_si256((__m256i*)s->cols);
+	__m256i left = _mm256_loadu_si256((__m256i*)s->left);
+	__m256i right = _mm256_loadu_si256((__m256i*)s->right);
+	__m256i depth = _mm256_loadu_si256((__m256i*)s->depth);
+	__m256i base = _mm256_loadu_si256((__m256i*)s->base);
+	__m256i active = _mm256_loadu_si256((__m256i*)s->active);
+
+	while (!_mm256_testz_si256(active, active))
+	{
+		__m256i empty = _mm256_cmpeq_epi32(avail, zero);
+		__m256i descend = _mm256_andnot_si256(empty, active);
+		__m256i pop = _mm256_and_si256(empty, active);
+
+		// pop first, so the stack slots read here can't be the ones pushed below.
+		if (!_mm256_testz_si256(pop, pop))
+		{
+			depth = _mm256_add_epi32(depth, pop);
+			__m256i finished = _mm256_and_si256(pop, _mm256_cmpgt_epi32(base, depth));
+			__m256i reload = _mm256_andnot_si256(finished, pop);
+			__m256i index = _mm256_add_epi32(_mm256_slli_epi32(depth, 3), laneIndex);
+			avail = _mm256_mask_i32gather_epi32(avail, (const int*)s->stackAvail, index, reload, 4);
+			cols = _mm256_mask_i32gather_epi32(cols, (const int*)s->stackCols, index, reload, 4);
+			left = _mm256_mask_i32gather_epi32(left, (const int*)s->stackLeft, index, reload, 4);
+			right = _mm256_mask_i32gather_epi32(right, (const int*)s->stackRight, index, reload, 4);
+
+			uint32_t finishedLanes = _mm256_movemask_ps(_mm256_castsi256_ps(finished));
+			if (finishedLanes != 0)
+			{
+				// refill pulls from the prefix queue, so spill, refill and reload.
+				_mm256_storeu_si256((__m256i*)s->avail, avail);
+				_mm256_storeu_si256((__m256i*)s->cols, cols);
+				_mm256_storeu_si256((__m256i*)s->left, left);
+				_mm256_storeu_si256((__m256i*)s->right, right);
+				_mm256_storeu_si256((__m256i*)s->depth, depth);
+				_mm256_storeu_si256((__m256i*)s->base, base);
+				_mm256_storeu_si256((__m256i*)s->active, active);
+				refillLanes(*s, finishedLanes);
+				avail = _mm256_loadu_si256((__m256i*)s->avail);
+				cols = _mm256_loadu_si256((__m256i*)s->cols);
+				left = _mm256_loadu_si256((__m256i*)s->left);
+				right = _mm256_loadu_si256((__m256i*)s->right);
+				depth = _mm256_loadu_si256((__m256i*)s->depth);
+				base = _mm256_loadu_si256((__m256i*)s->base);
+				active = _mm256_loadu_si256((__m256i*)s->active);
+			}
+		}
+
+		uint32_t descendLanes = _mm256_movemask_ps(_mm256_castsi256_ps(descend));
+		if (descendLanes == 0)
+			continue;
+
+		__m256i bit = _mm256_and_si256(avail, _mm256_sub_epi32(zero, avail));
+		__m256i rest = _mm256_xor_si256(avail, bit);
+
+		alignas(32) uint32_t pushAvail[8], pushCols[8], pushLeft[8], pushRight[8];
+		alignas(32) int32_t pushDepth[8];
+		_mm256_store_si256((__m256i*)pushAvail, rest);
+		_mm256_store_si256((__m256i*)pushCols, cols);
+		_mm256_store_si256((__m256i*)pushLeft, left);
+		_mm256_store_si256((__m256i*)pushRight, right);
+		_mm256_store_si256((__m256i*)pushDepth, depth);
+		for (uint32_t lanes = descendLanes; lanes != 0; lanes &= lanes - 1)
+		{
+			int l = __builtin_ctz(lanes);
+			s->stackAvail[pushDepth[l]][l] = pushAvail[l];
+			s->stackCols[pushDepth[l]][l] = pushCols[l];
+			s->stackLeft[pushDepth[l]][l] = pushLeft[l];
+			s->stackRight[pushDepth[l]][l] = pushRight[l];
+		}
+
+		cols = _mm256_blendv_epi8(cols, _mm256_or_si256(cols, bit), descend);
+		left = _mm256_blendv_epi8(left, _mm256_and_si256(_mm256_slli_epi32(_mm256_or_si256(left, bit), 1), full), descend);
+		right = _mm256_blendv_epi8(right, _mm256_srli_epi32(_mm256_or_si256(right, bit), 1), descend);
+		depth = _mm256_sub_epi32(depth, descend);
+
+		__m256i solved = _mm256_and_si256(descend, _mm256_cmpeq_epi32(depth, size));
+		__m256i next = _mm256_andnot_si256(_mm256_or_si256(cols, _mm256_or_si256(left, right)), full);
+		next = _mm256_andnot_si256(solved, next);
+		avail = _mm256_blendv_epi8(avail, next, descend);
+
+		uint32_t solvedLanes = _mm256_movemask_ps(_mm256_castsi256_ps(solved));
+		if (solvedLanes != 0)
+		{
+			_mm256_storeu_si256((__m256i*)s->cols, cols);
+			recordLaneSolutions(*s, solvedLanes);
+		}
+	}
+
+	delete s;
+}
+
+/**
+ * Lockstep engine, 16 lanes of AVX-512.  Same as the AVX2 version, except
+ * the mask registers and native scatter make it branch-free per step.
+ */
+__attribute__((target("avx512f")))
+void findSolutionsAVX512()
+{
+	LockstepState<16>* s = new LockstepState<16>();
+	refillLanes(*s, 0xFFFF);
+
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i full = _mm512_set1_epi32(fullMask);
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i laneIndex = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+	__m512i avail = _mm512_loadu_si512(s->avail);
+	__m512i cols = _mm512_loadu_si512(s->cols);
+	__m512i left = _mm512_loadu_si512(s->left);
+	__m512i right = _mm512_loadu_si512(s->right);
+	__m512i depth = _mm512_loadu_si512(s->depth);
+	__m512i base = _mm512_loadu_si512(s->base);
+	__mmask16 active = _mm512_test_epi32_mask(_mm512_loadu_si512(s->active), _mm512_loadu_si512(s->active));
+
+	while (active != 0)
+	{
+		__mmask16 descend = _mm512_mask_test_epi32_mask(active, avail, avail);
+		__mmask16 pop = active & ~descend;
+
+		if (pop != 0)
+		{
+			depth = _mm512_mask_sub_epi32(depth, pop, depth, one);
+			__mmask16 finished = _mm512_mask_cmplt_epi32_mask(pop, depth, base);
+			__mmask16 reload = pop & ~finished;
+			__m512i index = _mm512_add_epi32(_mm512_slli_epi32(depth, 4), laneIndex);
+			avail = _mm512_mask_i32gather_epi32(avail, reload, index, s->stackAvail, 4);
+			cols = _mm512_mask_i32gather_epi32(cols, reload, index, s->stackCols, 4);
+			left = _mm512_mask_i32gather_epi32(left, reload, index, s->stackLeft, 4);
+			right = _mm512_mask_i32gather_epi32(right, reload, index, s->stackRight, 4);
+
+			if (finished != 0)
+			{
+				_mm512_storeu_si512(s->avail, avail);
+				_mm512_storeu_si512(s->cols, cols);
+				_mm512_storeu_si512(s->left, left);
+				_mm512_storeu_si512(s->right, right);
+				_mm512_storeu_si512(s->depth, depth);
+				_mm512_storeu_si512(s->base, base);
+				refillLanes(*s, finished);
+				avail = _mm512_loadu_si512(s->avail);
+				cols = _mm512_loadu_si512(s->cols);
+				left = _mm512_loadu_si512(s->left);
+				right = _mm512_loadu_si512(s->right);
+				depth = _mm512_loadu_si512(s->depth);
+				base = _mm512_loadu_si512(s->base);
+				active = _mm512_test_epi32_mask(_mm512_loadu_si512(s->active), _mm512_loadu_si512(s->active));
+			}
+		}
+
+		if (descend == 0)
+			continue;
+
+		__m512i bit = _mm512_and_si512(avail, _mm512_sub_epi32(zero, avail));
+		__m512i index = _mm512_add_epi32(_mm512_slli_epi32(depth, 4), laneIndex);
+		_mm512_mask_i32scatter_epi32(s->stackAvail, descend, index, _mm512_xor_si512(avail, bit), 4);
+		_mm512_mask_i32scatter_epi32(s->stackCols, descend, index, cols, 4);
+		_mm512_mask_i32scatter_epi32(s->stackLeft, descend, index, left, 4);
+		_mm512_mask_i32scatter_epi32(s->stackRight, descend, index, right, 4);
+
+		cols = _mm512_mask_or_epi32(cols, descend, cols, bit);
+		left = _mm512_mask_and_epi32(left, descend, _mm512_slli_epi32(_mm512_or_si512(left, bit), 1), full);
+		right = _mm512_mask_srli_epi32(right, descend, _mm512_or_si512(right, bit), 1);
+		depth = _mm512_mask_add_epi32(depth, descend, depth, one);
+
+		__mmask16 solved = _mm512_mask_cmpeq_epi32_mask(descend, depth, _mm512_set1_epi32(BOARD_SIZE));
+		__m512i next = _mm512_andnot_si512(_mm512_or_si512(cols, _mm512_or_si512(left, right)), full);
+		avail = _mm512_mask_mov_epi32(avail, descend, next);
+		avail = _mm512_mask_mov_epi32(avail, solved, zero);
+
+		if (solved != 0)
+		{
+			_mm512_storeu_si512(s->cols, cols);
+			recordLaneSolutions(*s, solved);
+		}
+	}
+
+	delete s;
+}
+#endif
+
+/**
+ * Lockstep SIMD engine.  Picks the widest vector unit the CPU has at runtime,
+ * and falls back to the scalar bitmask engine without one.  Returns the name
+ * of the engine that actually ran.
+ */
+const char* findSolutionsSIMD()
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+	{
+		findSolutionsAVX512();
+		return "AVX-512, 16 lanes";
+	}
+	if (__builtin_cpu_supports("avx2"))
+	{
+		findSolutionsAVX2();
+		return "AVX2, 8 lanes";
+	}
+#endif
+	findSolutionsBitmask();
+	return "scalar fallback";
+}
+
 /**
  * Prints out a given board.
  */
@@ -206,11 +629,12 @@ void printBoard(int** b)
 }
 
 /**
- * Prints out the board for every solution found.
+ * Prints out the board for every solution found.  Only the first
+ * SOLUTION_SIZE solutions are kept around, so that's all we can print.
  */
 void printSolutions()
 {
-	for (int i = 0; i < num_solutions; i++)
+	for (int i = 0; i < num_solutions && i < SOLUTION_SIZE; i++)
 	{
 		cout << "Solution #" << i + 1 << ":" << endl;
 		printBoard(solutions[i]);
@@ -219,34 +643,26 @@ void printSolutions()
 }
 
 /**
- * Run the search, using a nxn board as specified from the command line.
+ * Sets up an empty n x n board and solution list, freeing the ones from any
+ * earlier run.
  */
-int main(int argc, char* argv[])
+void resetBoard(int n)
 {
-	if (argc != 2)
+	if (board != 0)
 	{
-		cout << "Usage:" << endl;
-		cout << "nqueens n" << endl;
-		cout << "where n is the number of queens." << endl;
-		return -1;
-	}
-
-	BOARD_SIZE = 0;
-	try
-	{
-		BOARD_SIZE = atoi(argv[1]);
-	}catch (int e)
-	{
-		cout << "Invalid argument " << argv[1] << endl;
-		return -1;
-	}
-
-	if (BOARD_SIZE < 5 || BOARD_SIZE > 20)
-	{
-		cout << "Whoa, there!  We're not running anything that big." << endl;
-		return -1;
+		for (int i = 0; i < num_solutions && i < SOLUTION_SIZE; i++)
+		{
+			for (int y = 0; y < BOARD_SIZE; y++)
+				delete[] solutions[i][y];
+			delete[] solutions[i];
+		}
+		for (int y = 0; y < BOARD_SIZE; y++)
+			delete[] board[y];
+		delete[] board;
+		delete[] solutions;
 	}
 
+	BOARD_SIZE = n;
 	board = new int*[BOARD_SIZE];
 	solutions = new int**[SOLUTION_SIZE];
 
@@ -265,15 +681,113 @@ int main(int argc, char* argv[])
 	}
 
 	num_solutions = 0;
+	prefixes.clear();
+	nextPrefix = 0;
+}
+
+/**
+ * Finds every solution on the current board with the named engine.
+ * Returns a description of the engine that ran.
+ */
+const char* runEngine(const char* engine)
+{
+	if (strcmp(engine, "naive") == 0)
+	{
+		findSolutions(0);
+		return "naive";
+	}
+
+	int queens[MAX_BOARD_SIZE] = {};
+	fullMask = (1u << BOARD_SIZE) - 1;
+	buildPrefixes(0, 0, 0, 0, queens);
+	if (strcmp(engine, "bitmask") == 0)
+	{
+		findSolutionsBitmask();
+		return "bitmask";
+	}
+	return findSolutionsSIMD();
+}
+
+/**
+ * Times every engine on a few board sizes and prints the results as JSON
+ * for the benchmark runner.
+ */
+int runBenchmark()
+{
+	const char* engines[] = {"naive", "bitmask", "bitmask", "simd", "simd"};
+	const int sizes[] = {6, 8, 12, 8, 12};
+	vector<Measurement> results;
+	for (int i = 0; i < 5; i++)
+	{
+		const char* engine = engines[i];
+		int n = sizes[i];
+		char name[32];
+		sprintf(name, "%s/%d", engine, n);
+		results.push_back(measure("nqueens", name, [engine, n]()
+		{
+			resetBoard(n);
+			runEngine(engine);
+		}, 2, 10));
+	}
+	printJson(stdout, results);
+	return 0;
+}
+
+/**
+ * Run the search, using a nxn board as specified from the command line.
+ */
+int main(int argc, char* argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "bench") == 0)
+	{
+		return runBenchmark();
+	}
 
-	clock_t start = clock();
-	findSolutions(0);
-	clock_t end = clock();
+	if (argc != 2 && argc != 3)
+	{
+		cout << "Usage:" << endl;
+		cout << "nqueens n [engine]" << endl;
+		cout << "where n is the number of queens, and engine is one of" << endl;
+		cout << "naive (the default), bitmask or simd, or" << endl;
+		cout << "nqueens bench" << endl;
+		cout << "to time every engine and print the results as JSON." << endl;
+		return -1;
+	}
 
-	double seconds = double(end - start) / CLOCKS_PER_SEC;
+	const char* engine = (argc == 3) ? argv[2] : "naive";
+	if (strcmp(engine, "naive") != 0 && strcmp(engine, "bitmask") != 0 && strcmp(engine, "simd") != 0)
+	{
+		cout << "Unknown engine " << engine << endl;
+		return -1;
+	}
+
+	int n = 0;
+	try
+	{
+		n = atoi(argv[1]);
+	}catch (int e)
+	{
+		cout << "Invalid argument " << argv[1] << endl;
+		return -1;
+	}
+
+	if (n < 5 || n > MAX_BOARD_SIZE)
+	{
+		cout << "Whoa, there!  We're not running anything that big." << endl;
+		return -1;
+	}
+
+	resetBoard(n);
+	double start = monotonicSeconds();
+	const char* ran = runEngine(engine);
+	double seconds = monotonicSeconds() - start;
+
+	if (strcmp(engine, "simd") == 0)
+	{
+		cout << "Lockstep engine: " << ran << endl;
+	}
 
 	printSolutions();
 
 	cout << "Found  " << num_solutions << " solutions in " << seconds << " seconds." << endl;
 }
-
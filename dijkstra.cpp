@@ -6,9 +6,20 @@
  * Modified: 08-19-2015
  */
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 #include <vector>
 
+#include "timing.h"
+
 using namespace std;
 
 #define VACANT 0
@@ -81,6 +92,21 @@ void buildGraphList(int** myBoard, int start_x, int start_y, int end_x, int end_
 	}
 }
 
+// Frees the nodes buildGraphList made.
+void freeGraphList()
+{
+	for (int j = 0; j < BOARD_SIZE; j++)
+	{
+		for (int i = 0; i < BOARD_SIZE; i++)
+		{
+			delete myNodes[j][i];
+		}
+		delete[] myNodes[j];
+	}
+	delete[] myNodes;
+	myNodes = 0;
+}
+
 void printDistances()
 {
 	for (int j = 0; j < BOARD_SIZE; j++)
@@ -120,11 +146,10 @@ GraphNode* findClosestUnvisited()
 
 /**
  * Finds the shortest path to the end location using the priority queue l.
+ * The path is empty if the end can't be reached.
  */
 vector<GraphNode*>* dijkstra(int end_x, int end_y)
 {
-	vector<GraphNode*>* path = new vector<GraphNode*>();
-
 	while (findClosestUnvisited() != 0)
 	{
 		GraphNode* g = findClosestUnvisited();
@@ -162,6 +187,10 @@ vector<GraphNode*>* dijkstra(int end_x, int end_y)
 	// so, now that all the distances are correct, let's backtrack from the goal to the start.
 	vector<GraphNode*>* v = new vector<GraphNode*>();
 	GraphNode* g = myNodes[end_y][end_x];
+	if (g == 0 || g->distance == INFINITE)
+	{
+		return v;
+	}
 	while (g->distance != 0)
 	{
 		v->push_back(g);
@@ -199,11 +228,579 @@ vector<GraphNode*>* dijkstra(int end_x, int end_y)
 	return v;
 }
 
-int main(int argc, char* arg[])
+/**
+ * Flow fields, for when many agents share one goal.
+ *
+ * Instead of a search per agent, one breadth-first search runs backwards
+ * from the goal over the whole board (every step costs the same, so it gives
+ * the same distances as Dijkstra's algorithm).  Each cell then gets the
+ * direction of a neighbour one step closer, packed DIRECTION_BITS bits to a
+ * cell into atomic words, so an agent takes a step with a single load and
+ * any number of agents can read while the field is being updated: a cell
+ * reads as either its old direction or its new one, never a mix.  Only one
+ * thread may update the field at a time.
+ *
+ * When the goal moves, every distance on the board changes, so rather than
+ * redo them all the field keeps the directions towards the goal it was last
+ * built for (the anchor) everywhere but within REPAIR_RADIUS steps of it.
+ * Only that region is searched again, from the new goal.  Agents outside
+ * follow the old directions into the region, and inside it they're led to
+ * the new goal, taking at most twice the goal's distance from the anchor in
+ * extra steps.  Once the goal is more than REPAIR_DRIFT steps from the
+ * anchor, the whole field is rebuilt around it.
+ */
+#define GOAL 4
+#define UNREACHABLE 7
+
+const int DIRECTION_BITS = 3;
+const int CELLS_PER_WORD = 64 / DIRECTION_BITS;
+const int REPAIR_RADIUS = 16;
+const int REPAIR_DRIFT = 4;
+
+class FlowField
 {
-	//priorityQueueTest();
+public:
+	FlowField(int** myBoard, int new_width, int new_height);
+	~FlowField();
+	// it owns its words, so it can't be copied.
+	FlowField(const FlowField&) = delete;
+	FlowField& operator=(const FlowField&) = delete;
+	void build(int goal_x, int goal_y);
+	void moveGoal(int goal_x, int goal_y);
+	int direction(int x, int y) const;
+	bool step(int& x, int& y) const;
+	int width, height;
+	int goalX, goalY;
+	// how many cells the last update searched.
+	int searched;
 
-	// initialize the board
+private:
+	void search(int from, int limit, vector<int>& dist, vector<int>& order);
+	int nextDirection(int cell, const vector<int>& dist) const;
+	void setDirection(int cell, int dir);
+	void publish();
+	int** board;
+	int cells;
+	int anchor;
+	// distances from the anchor, and the cells in the order the search
+	// reached them, so the region around it is the first regionSize.
+	vector<int> anchorDistance;
+	vector<int> anchorOrder;
+	int regionSize;
+	// distances from the goal within the region.
+	vector<int> repairDistance;
+	vector<int> repairOrder;
+	// the field as it will be once the dirty words are published.
+	vector<uint64_t> packed;
+	vector<int> dirty;
+	atomic<uint64_t>* words;
+};
+
+FlowField::FlowField(int** myBoard, int new_width, int new_height)
+{
+	board = myBoard;
+	width = new_width;
+	height = new_height;
+	cells = width * height;
+	int numWords = (cells + CELLS_PER_WORD - 1) / CELLS_PER_WORD;
+	packed.assign(numWords, 0);
+	words = new atomic<uint64_t>[numWords];
+	for (int w = 0; w < numWords; w++)
+	{
+		// every cell starts out unreachable.
+		for (int i = 0; i < CELLS_PER_WORD; i++)
+			packed[w] |= (uint64_t)UNREACHABLE << (i * DIRECTION_BITS);
+		words[w].store(packed[w]);
+	}
+	anchorDistance.assign(cells, INFINITE);
+	repairDistance.assign(cells, INFINITE);
+	anchor = -1;
+	regionSize = 0;
+	goalX = -1;
+	goalY = -1;
+	searched = 0;
+}
+
+FlowField::~FlowField()
+{
+	delete[] words;
+}
+
+/**
+ * Breadth-first search from the cell from over the vacant cells, or only
+ * those within limit steps of the anchor if limit isn't 0.  Fills in dist,
+ * which must be INFINITE for every cell it can reach, and the order the
+ * cells were reached in.
+ */
+void FlowField::search(int from, int limit, vector<int>& dist, vector<int>& order)
+{
+	order.clear();
+	dist[from] = 0;
+	order.push_back(from);
+	for (size_t next = 0; next < order.size(); next++)
+	{
+		int cell = order[next];
+		int x = cell % width;
+		int y = cell / width;
+		int neighbourX[4] = {x, x + 1, x, x - 1};
+		int neighbourY[4] = {y - 1, y, y + 1, y};
+		for (int d = UP; d <= LEFT; d++)
+		{
+			int i = neighbourX[d];
+			int j = neighbourY[d];
+			int n = j * width + i;
+			if (i < 0 || i >= width || j < 0 || j >= height || dist[n] != INFINITE || board[j][i] != VACANT)
+				continue;
+			if (limit > 0 && anchorDistance[n] > limit)
+				continue;
+			dist[n] = dist[cell] + 1;
+			order.push_back(n);
+		}
+	}
+}
+
+/**
+ * Returns the way from cell to a neighbour one step closer to where dist
+ * was measured from, trying up, right, down and left in that order like
+ * dijkstra()'s backtrack.
+ */
+int FlowField::nextDirection(int cell, const vector<int>& dist) const
+{
+	if (dist[cell] == 0)
+		return GOAL;
+	if (dist[cell] == INFINITE)
+		return UNREACHABLE;
+	int x = cell % width;
+	int y = cell / width;
+	if (y > 0 && dist[cell - width] == dist[cell] - 1)
+		return UP;
+	if (x < width - 1 && dist[cell + 1] == dist[cell] - 1)
+		return RIGHT;
+	if (y < height - 1 && dist[cell + width] == dist[cell] - 1)
+		return DOWN;
+	return LEFT;
+}
+
+void FlowField::setDirection(int cell, int dir)
+{
+	int w = cell / CELLS_PER_WORD;
+	int shift = (cell % CELLS_PER_WORD) * DIRECTION_BITS;
+	uint64_t value = (packed[w] & ~((uint64_t)UNREACHABLE << shift)) | ((uint64_t)dir << shift);
+	if (value == packed[w])
+		return;
+	if (dirty.empty() || dirty.back() != w)
+		dirty.push_back(w);
+	packed[w] = value;
+}
+
+// Makes the changed words visible to the agents.
+void FlowField::publish()
+{
+	sort(dirty.begin(), dirty.end());
+	dirty.erase(unique(dirty.begin(), dirty.end()), dirty.end());
+	for (size_t i = 0; i < dirty.size(); i++)
+		words[dirty[i]].store(packed[dirty[i]], memory_order_release);
+	dirty.clear();
+}
+
+/**
+ * Builds the whole field for a goal, which becomes the anchor.  Every cell
+ * is unreachable if the goal isn't a vacant cell on the board.
+ */
+void FlowField::build(int goal_x, int goal_y)
+{
+	goalX = goal_x;
+	goalY = goal_y;
+	for (int cell = 0; cell < cells; cell++)
+		anchorDistance[cell] = INFINITE;
+	for (size_t i = 0; i < repairOrder.size(); i++)
+		repairDistance[repairOrder[i]] = INFINITE;
+	anchorOrder.clear();
+	repairOrder.clear();
+	anchor = -1;
+	regionSize = 0;
+	if (goal_x >= 0 && goal_x < width && goal_y >= 0 && goal_y < height && board[goal_y][goal_x] == VACANT)
+	{
+		anchor = goal_y * width + goal_x;
+		search(anchor, 0, anchorDistance, anchorOrder);
+		while (regionSize < (int)anchorOrder.size() && anchorDistance[anchorOrder[regionSize]] <= REPAIR_RADIUS)
+			regionSize++;
+	}
+	searched = anchorOrder.size();
+
+	for (int cell = 0; cell < cells; cell++)
+		setDirection(cell, nextDirection(cell, anchorDistance));
+	publish();
+}
+
+/**
+ * Moves the goal, searching only the region around the anchor if the goal
+ * is still close enough to it.
+ */
+void FlowField::moveGoal(int goal_x, int goal_y)
+{
+	if (anchor < 0 || goal_x < 0 || goal_x >= width || goal_y < 0 || goal_y >= height
+		|| anchorDistance[goal_y * width + goal_x] > REPAIR_DRIFT)
+	{
+		build(goal_x, goal_y);
+		return;
+	}
+
+	goalX = goal_x;
+	goalY = goal_y;
+	for (size_t i = 0; i < repairOrder.size(); i++)
+		repairDistance[repairOrder[i]] = INFINITE;
+	search(goal_y * width + goal_x, REPAIR_RADIUS, repairDistance, repairOrder);
+	searched = repairOrder.size();
+
+	// the region is connected through the anchor, so the search reaches all of it.
+	for (int i = 0; i < regionSize; i++)
+	{
+		int cell = anchorOrder[i];
+		setDirection(cell, nextDirection(cell, repairDistance));
+	}
+	publish();
+}
+
+// Returns which way to go from a cell: UP to LEFT, GOAL or UNREACHABLE.
+int FlowField::direction(int x, int y) const
+{
+	if (x < 0 || x >= width || y < 0 || y >= height)
+		return UNREACHABLE;
+	int cell = y * width + x;
+	uint64_t word = words[cell / CELLS_PER_WORD].load(memory_order_acquire);
+	return (word >> ((cell % CELLS_PER_WORD) * DIRECTION_BITS)) & UNREACHABLE;
+}
+
+/**
+ * Moves an agent at (x, y) one step along the field.  Returns false, and
+ * leaves it where it is, if it's at the goal or can't reach it.
+ */
+bool FlowField::step(int& x, int& y) const
+{
+	switch (direction(x, y))
+	{
+	case UP:
+		y--;
+		return true;
+	case RIGHT:
+		x++;
+		return true;
+	case DOWN:
+		y++;
+		return true;
+	case LEFT:
+		x--;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Finds the shortest path between two cells of a board with dijkstra(), as
+ * the cells from start to end (each y * BOARD_SIZE + x).  Returns false,
+ * with the path empty, if there isn't one.
+ */
+bool findPath(int** myBoard, int start_x, int start_y, int end_x, int end_y, vector<int>& path)
+{
+	buildGraphList(myBoard, start_x, start_y, end_x, end_y);
+	vector<GraphNode*>* v = dijkstra(end_x, end_y);
+	path.clear();
+	while (v->size() > 0)
+	{
+		path.push_back(v->back()->y * BOARD_SIZE + v->back()->x);
+		v->pop_back();
+	}
+	delete v;
+	freeGraphList();
+	return !path.empty();
+}
+
+/**
+ * Path cache.
+ *
+ * Answers repeated path queries on a board that changes now and then.  Paths
+ * are stored by start and goal, and every one stored is valid for the board
+ * as it is now; a query made against an older map version is a miss.  When
+ * a cell changes only the paths it could affect are dropped:
+ *
+ * - a new obstacle drops every path through its tile, found through a
+ *   reverse index from each TILE_SIZE square tile to the paths crossing it;
+ * - a removed obstacle can only shorten a path of length L from s to g if
+ *   |s - c| + |c - g| < L in Manhattan distance, so only paths whose ellipse
+ *   holds the cell are dropped, along with the "no path" answers.
+ *
+ * Lookups share a reader lock, so any number of threads can hit at once.
+ * Misses run dijkstra(), which works on the global myNodes, so they take
+ * turns under searchLock, and so do board changes.  Entries are evicted
+ * second-chance style (the CLOCK algorithm) to keep the cache's memory
+ * under its budget, since readers can mark an entry used without taking the
+ * write lock where a true LRU list would have to be reordered.
+ */
+const int TILE_SIZE = 2;
+const size_t PATH_CACHE_BUDGET = 64 * 1024;
+const int TILES_ACROSS = (BOARD_SIZE + TILE_SIZE - 1) / TILE_SIZE;
+const int NUM_CELLS = BOARD_SIZE * BOARD_SIZE;
+
+struct CachedPath
+{
+	vector<int> cells;
+	// the distinct tiles the path crosses.
+	vector<int> tiles;
+	size_t bytes;
+	long id;
+	mutable atomic<bool> used;
+};
+
+class PathCache
+{
+public:
+	PathCache(int** myBoard, size_t new_budget);
+	~PathCache();
+	bool findPath(int start_x, int start_y, int end_x, int end_y, long map_version, vector<int>& path);
+	void setCell(int x, int y, int value);
+	long version() const;
+	size_t bytes() const;
+	size_t size() const;
+	atomic<long> hits, misses, invalidations, evictions;
+
+private:
+	bool lookup(int key, long map_version, vector<int>& path);
+	void insert(int key, const vector<int>& path);
+	void erase(int key);
+	void evict();
+	int** board;
+	size_t budget;
+	size_t used;
+	long mapVersion;
+	long nextId;
+	mutable shared_timed_mutex lock;
+	mutex searchLock;
+	unordered_map<int, CachedPath*> paths;
+	vector<int> tilePaths[TILES_ACROSS * TILES_ACROSS];
+	// keys and ids in the order the clock hand visits them.
+	deque<pair<int, long> > clock;
+};
+
+inline int cellTile(int cell)
+{
+	return (cell / BOARD_SIZE / TILE_SIZE) * TILES_ACROSS + (cell % BOARD_SIZE) / TILE_SIZE;
+}
+
+inline int manhattan(int a, int b)
+{
+	return abs(a / BOARD_SIZE - b / BOARD_SIZE) + abs(a % BOARD_SIZE - b % BOARD_SIZE);
+}
+
+PathCache::PathCache(int** myBoard, size_t new_budget)
+{
+	board = myBoard;
+	budget = new_budget;
+	used = 0;
+	mapVersion = 0;
+	nextId = 0;
+	hits = 0;
+	misses = 0;
+	invalidations = 0;
+	evictions = 0;
+}
+
+PathCache::~PathCache()
+{
+	for (unordered_map<int, CachedPath*>::iterator i = paths.begin(); i != paths.end(); i++)
+		delete i->second;
+}
+
+long PathCache::version() const
+{
+	shared_lock<shared_timed_mutex> reading(lock);
+	return mapVersion;
+}
+
+size_t PathCache::bytes() const
+{
+	shared_lock<shared_timed_mutex> reading(lock);
+	return used;
+}
+
+size_t PathCache::size() const
+{
+	shared_lock<shared_timed_mutex> reading(lock);
+	return paths.size();
+}
+
+bool PathCache::lookup(int key, long map_version, vector<int>& path)
+{
+	shared_lock<shared_timed_mutex> reading(lock);
+	if (map_version != mapVersion)
+		return false;
+	unordered_map<int, CachedPath*>::iterator i = paths.find(key);
+	if (i == paths.end())
+		return false;
+	i->second->used.store(true, memory_order_relaxed);
+	path = i->second->cells;
+	return true;
+}
+
+/**
+ * Finds the shortest path from start to end, caching it.  map_version is
+ * the version of the board the caller knows of (from version()); if the
+ * board has changed since, it's a miss and the path is found on the board
+ * as it is now.  Returns false, with the path empty, if there isn't one
+ * (those answers are cached too) or either end is off the board.
+ */
+bool PathCache::findPath(int start_x, int start_y, int end_x, int end_y, long map_version, vector<int>& path)
+{
+	if (start_x < 0 || start_x >= BOARD_SIZE || start_y < 0 || start_y >= BOARD_SIZE
+		|| end_x < 0 || end_x >= BOARD_SIZE || end_y < 0 || end_y >= BOARD_SIZE)
+	{
+		path.clear();
+		return false;
+	}
+	int key = (start_y * BOARD_SIZE + start_x) * NUM_CELLS + end_y * BOARD_SIZE + end_x;
+	if (lookup(key, map_version, path))
+	{
+		hits++;
+		return !path.empty();
+	}
+
+	misses++;
+	lock_guard<mutex> searching(searchLock);
+	// another thread may have just found it.
+	if (lookup(key, version(), path))
+		return !path.empty();
+	::findPath(board, start_x, start_y, end_x, end_y, path);
+	unique_lock<shared_timed_mutex> writing(lock);
+	insert(key, path);
+	return !path.empty();
+}
+
+// Adds a path, evicting others to make room.  Needs the write lock.
+void PathCache::insert(int key, const vector<int>& path)
+{
+	if (paths.count(key) != 0)
+		return;
+	CachedPath* p = new CachedPath();
+	p->cells = path;
+	for (size_t i = 0; i < path.size(); i++)
+		p->tiles.push_back(cellTile(path[i]));
+	sort(p->tiles.begin(), p->tiles.end());
+	p->tiles.erase(unique(p->tiles.begin(), p->tiles.end()), p->tiles.end());
+	p->bytes = sizeof(CachedPath) + (path.size() + 2 * p->tiles.size()) * sizeof(int);
+	p->id = nextId++;
+	p->used = false;
+	if (p->bytes > budget)
+	{
+		delete p;
+		return;
+	}
+
+	while (used + p->bytes > budget)
+		evict();
+	paths[key] = p;
+	used += p->bytes;
+	for (size_t i = 0; i < p->tiles.size(); i++)
+		tilePaths[p->tiles[i]].push_back(key);
+	clock.push_back(make_pair(key, p->id));
+}
+
+// Removes a path and its reverse index entries.  Needs the write lock.
+void PathCache::erase(int key)
+{
+	unordered_map<int, CachedPath*>::iterator i = paths.find(key);
+	CachedPath* p = i->second;
+	for (size_t t = 0; t < p->tiles.size(); t++)
+	{
+		vector<int>& keys = tilePaths[p->tiles[t]];
+		keys.erase(find(keys.begin(), keys.end(), key));
+	}
+	used -= p->bytes;
+	delete p;
+	paths.erase(i);
+}
+
+/**
+ * Moves the clock hand on to the first path not used since it last came
+ * round, and evicts it.  Needs the write lock.
+ */
+void PathCache::evict()
+{
+	while (!clock.empty())
+	{
+		pair<int, long> next = clock.front();
+		clock.pop_front();
+		unordered_map<int, CachedPath*>::iterator i = paths.find(next.first);
+		// skip what was invalidated since.
+		if (i == paths.end() || i->second->id != next.second)
+			continue;
+		if (i->second->used.exchange(false, memory_order_relaxed))
+		{
+			clock.push_back(next);
+			continue;
+		}
+		erase(next.first);
+		evictions++;
+		return;
+	}
+}
+
+/**
+ * Changes a cell of the board, VACANT or an obstacle, and drops the cached
+ * paths the change could affect.  Does nothing if it's off the board.
+ */
+void PathCache::setCell(int x, int y, int value)
+{
+	if (x < 0 || x >= BOARD_SIZE || y < 0 || y >= BOARD_SIZE)
+		return;
+	lock_guard<mutex> searching(searchLock);
+	unique_lock<shared_timed_mutex> writing(lock);
+	bool blocking = (board[y][x] == VACANT);
+	if (blocking == (value == VACANT))
+	{
+		// one obstacle for another changes no path.
+		board[y][x] = value;
+		return;
+	}
+	board[y][x] = value;
+	mapVersion++;
+
+	int cell = y * BOARD_SIZE + x;
+	vector<int> affected;
+	if (blocking)
+	{
+		affected = tilePaths[cellTile(cell)];
+	}else
+	{
+		for (unordered_map<int, CachedPath*>::iterator i = paths.begin(); i != paths.end(); i++)
+		{
+			const vector<int>& cells = i->second->cells;
+			if (cells.empty() || manhattan(cells.front(), cell) + manhattan(cell, cells.back()) < (int)cells.size() - 1)
+				affected.push_back(i->first);
+		}
+	}
+	for (size_t i = 0; i < affected.size(); i++)
+		erase(affected[i]);
+	invalidations += affected.size();
+
+	// clear out the clock's stale entries once they're the bulk of it.
+	if (clock.size() > 2 * paths.size() + 64)
+	{
+		deque<pair<int, long> > live;
+		for (size_t i = 0; i < clock.size(); i++)
+		{
+			unordered_map<int, CachedPath*>::iterator p = paths.find(clock[i].first);
+			if (p != paths.end() && p->second->id == clock[i].second)
+				live.push_back(clock[i]);
+		}
+		clock.swap(live);
+	}
+}
+
+/**
+ * Builds the test board: open space with a few walls in the way.
+ */
+int** buildTestBoard()
+{
 	int** myBoard;
 	myBoard = new int*[BOARD_SIZE];
 	for (int j = 0; j < BOARD_SIZE; j++)
@@ -224,6 +821,195 @@ int main(int argc, char* arg[])
 	myBoard[1][6] = 1;
 	myBoard[2][8] = 1;
 	myBoard[3][8] = 1;
+	return myBoard;
+}
+
+// Frees a board made by buildTestBoard or buildLargeBoard.
+void freeBoard(int** myBoard, int rows)
+{
+	for (int j = 0; j < rows; j++)
+	{
+		delete[] myBoard[j];
+	}
+	delete[] myBoard;
+}
+
+/**
+ * Builds a bigger board for the flow field benchmarks, with about one cell
+ * in five blocked, the same every time.
+ */
+int** buildLargeBoard(int size)
+{
+	int** myBoard = new int*[size];
+	unsigned seed = 2015;
+	for (int j = 0; j < size; j++)
+	{
+		myBoard[j] = new int[size];
+		for (int i = 0; i < size; i++)
+		{
+			seed = seed * 1103515245 + 12345;
+			myBoard[j][i] = ((seed >> 16) % 5 == 0) ? 1 : VACANT;
+		}
+	}
+	myBoard[size / 2][size / 2] = VACANT;
+	myBoard[size / 2][size / 2 + 1] = VACANT;
+	return myBoard;
+}
+
+/**
+ * Times a full path query on the test board, graph building included, and
+ * the same query answered by the path cache, then the flow fields: building
+ * one, repairing one after the goal moves a step, and one step for each of
+ * a thousand agents.  Prints the results as JSON for the benchmark runner.
+ */
+int runBenchmark()
+{
+	int** myBoard = buildTestBoard();
+	vector<Measurement> results;
+	results.push_back(measure("dijkstra", "path/10x10", [myBoard]()
+	{
+		buildGraphList(myBoard, 0, 9, 9, 0);
+		delete dijkstra(9, 0);
+		freeGraphList();
+	}, 10, 200));
+	PathCache cache(myBoard, PATH_CACHE_BUDGET);
+	results.push_back(measure("dijkstra", "path/cached/10x10", [&cache]()
+	{
+		vector<int> path;
+		cache.findPath(0, 9, 9, 0, cache.version(), path);
+	}, 10, 200));
+
+	const int size = 256;
+	const int agents = 1000;
+	int** largeBoard = buildLargeBoard(size);
+	FlowField field(largeBoard, size, size);
+	results.push_back(measure("dijkstra", "flow/build/256x256", [&field]()
+	{
+		field.build(size / 2, size / 2);
+	}, 2, 20));
+	bool moved = false;
+	results.push_back(measure("dijkstra", "flow/move/256x256", [&field, &moved]()
+	{
+		field.moveGoal(size / 2 + (moved ? 0 : 1), size / 2);
+		moved = !moved;
+	}, 2, 100));
+	vector<int> positions;
+	for (int a = 0; a < agents; a++)
+		positions.push_back((a * 7919) % (size * size));
+	results.push_back(measure("dijkstra", "flow/step/1000", [&field, &positions]()
+	{
+		for (int a = 0; a < agents; a++)
+		{
+			int x = positions[a] % size;
+			int y = positions[a] / size;
+			field.step(x, y);
+			positions[a] = y * size + x;
+		}
+	}, 10, 200));
+	printJson(stdout, results);
+	freeBoard(largeBoard, size);
+	freeBoard(myBoard, BOARD_SIZE);
+	return 0;
+}
+
+/**
+ * Shows the flow field for the test board, walks an agent along it, then
+ * moves the goal and does it again.
+ */
+int runFlowDemo()
+{
+	int** myBoard = buildTestBoard();
+	FlowField field(myBoard, BOARD_SIZE, BOARD_SIZE);
+	const char* arrows = "^>v<G??#";
+	int goals[2][2] = {{9, 0}, {7, 0}};
+	for (int g = 0; g < 2; g++)
+	{
+		if (g == 0)
+			field.build(goals[g][0], goals[g][1]);
+		else
+			field.moveGoal(goals[g][0], goals[g][1]);
+		cout << "Flow field to (" << field.goalX << ", " << field.goalY << "), "
+			<< field.searched << " cells searched:" << endl;
+		for (int j = 0; j < BOARD_SIZE; j++)
+		{
+			for (int i = 0; i < BOARD_SIZE; i++)
+			{
+				cout << arrows[field.direction(i, j)] << " ";
+			}
+			cout << endl;
+		}
+
+		int x = 0;
+		int y = 9;
+		int steps = 0;
+		while (field.step(x, y))
+			steps++;
+		cout << "Agent from (0, 9) took " << steps << " steps." << endl << endl;
+	}
+	freeBoard(myBoard, BOARD_SIZE);
+	return 0;
+}
+
+/**
+ * Runs a stream of repeated queries through the path cache on the test
+ * board, changing a couple of cells along the way, and prints its counts.
+ */
+int runCacheDemo()
+{
+	int** myBoard = buildTestBoard();
+	PathCache cache(myBoard, PATH_CACHE_BUDGET);
+	int queries[4][4] = {{0, 9, 9, 0}, {0, 0, 9, 9}, {5, 5, 9, 0}, {0, 9, 6, 9}};
+	for (int round = 0; round < 3; round++)
+	{
+		if (round == 1)
+		{
+			// block the way along the bottom.
+			cache.setCell(4, 9, 1);
+		}else if (round == 2)
+		{
+			// and open a gap in the wall at the top right.
+			cache.setCell(7, 1, VACANT);
+		}
+		for (int n = 0; n < 100; n++)
+		{
+			int* q = queries[n % 4];
+			vector<int> path;
+			cache.findPath(q[0], q[1], q[2], q[3], cache.version(), path);
+			if (n < 4)
+			{
+				cout << "(" << q[0] << ", " << q[1] << ") to (" << q[2] << ", " << q[3] << "): "
+					<< (path.empty() ? -1 : (int)path.size() - 1) << " steps" << endl;
+			}
+		}
+		cout << "Map version " << cache.version() << ": " << cache.hits << " hits, " << cache.misses << " misses, "
+			<< cache.invalidations << " invalidated, " << cache.evictions << " evicted, " << cache.size()
+			<< " paths in " << cache.bytes() << " bytes." << endl << endl;
+	}
+	freeBoard(myBoard, BOARD_SIZE);
+	return 0;
+}
+
+int main(int argc, char* arg[])
+{
+	//priorityQueueTest();
+
+	if (argc == 2 && strcmp(arg[1], "bench") == 0)
+	{
+		return runBenchmark();
+	}
+
+	if (argc == 2 && strcmp(arg[1], "flow") == 0)
+	{
+		return runFlowDemo();
+	}
+
+	if (argc == 2 && strcmp(arg[1], "cache") == 0)
+	{
+		return runCacheDemo();
+	}
+
+	// initialize the board
+	int** myBoard = buildTestBoard();
 
 	for (int j = 0; j < BOARD_SIZE; j++)
 	{
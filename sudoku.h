@@ -0,0 +1,66 @@
+/**
+ * C interface to the reentrant solver in sudoku_candidate.cpp.
+ *
+ * Build sudoku_candidate.cpp with SUDOKU_LIBRARY defined to leave out its
+ * main and link it in.  sudoku_solve, and sudoku_count with threads set to
+ * 1, keep all their state on their own stack and allocate nothing, so any
+ * number of threads can call them at once.  sudoku_count with any other
+ * number of threads allocates work lists and starts threads of its own.
+ */
+#ifndef SUDOKU_H
+#define SUDOKU_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Results of sudoku_solve. */
+#define SUDOKU_SOLVED 1
+#define SUDOKU_UNSOLVABLE 0
+#define SUDOKU_INVALID -1
+#define SUDOKU_GAVE_UP -2
+
+typedef struct sudoku_options
+{
+	/* nonzero to use locked candidates as well as singles. */
+	int locked_candidates;
+	/* give up after this many guesses, or never if 0. */
+	long max_guesses;
+	/*
+	 * threads sudoku_count splits a puzzle across, or 0 for one per core.
+	 * Anything but 1 allocates and starts threads.
+	 */
+	int threads;
+} sudoku_options;
+
+typedef struct sudoku_stats
+{
+	long guesses;
+	long backtracks;
+	long propagations;
+} sudoku_stats;
+
+/* Fills in the options sudoku_solve uses when it's given none. */
+void sudoku_default_options(sudoku_options* options);
+
+/*
+ * Solves the 9x9 puzzle in (in reading order, 0 for an empty cell) into
+ * out.  options and stats may both be null.  Returns SUDOKU_SOLVED,
+ * SUDOKU_UNSOLVABLE, SUDOKU_INVALID if the clues are out of range or clash,
+ * or SUDOKU_GAVE_UP if the guess limit ran out.
+ */
+int sudoku_solve(const uint8_t in[81], uint8_t out[81], const sudoku_options* options, sudoku_stats* stats);
+
+/*
+ * Counts the solutions of the puzzle in, stopping at cap (0 to count them
+ * all, 2 to check a puzzle is unique).  Returns the count, or SUDOKU_INVALID.
+ */
+long sudoku_count(const uint8_t in[81], long cap, const sudoku_options* options, sudoku_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,29 @@
  * Finished: 08-03-2015
  */
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "sudoku.h"
+#include "timing.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
 
 using namespace std;
 
@@ -14,9 +37,6 @@ const int BOARD_SIZE = 9;
 int** board;
 int*** candidates;
 
-int bestGuessRow;
-int bestGuessColumn;
-
 void printBoard()
 {
 	for (int y = 0; y < BOARD_SIZE; y++)
@@ -232,38 +252,20 @@ void updateCandidates()
 	{
 		for (int i = 0; i < BOARD_SIZE; i++)
 		{
-			/**
-			if ((j == 7 && i ==8) || (j == 8 && i == 1))
-			{
-				for (int x = 0; x < BOARD_SIZE; x++)
-				{
-					cout << candidates[8][0][x] << " ";
-				}
-			}
-			**/
-			if (candidates[8][0][8] == 1)
-			{
-				//cout << "Still alive at (" << i << ", " << j << ") " << endl;
-			}
-
 			if (board[j][i] != 0)
 			{
-				if (i == 0 && j == 8 && candidates[8][0][8] == 1)
-					cout << "Row broken." << endl;
 				removeCandidateRow(j, board[j][i]);
-				if (i == 0 && j == 8 && candidates[8][0][8] == 1)
-					cout << "Row works." << endl;
 				removeCandidateColumn(i, board[j][i]);
-				if (i == 0 && j == 8 && candidates[8][0][8] == 1)
-					cout << "Column works." << endl;
 				removeCandidateBox(getBox(i, j), board[j][i]);
-				if (i == 0 && j == 8 && candidates[8][0][8] == 1)
-					cout << "Box works." << endl;
 			}
 		}
 	}
 }
 
+/**
+ * Returns the vacant cell with the fewest candidates, as row * BOARD_SIZE +
+ * column, or -1 if no vacant cell has any.
+ */
 int findBestGuess()
 {
 	int lowestRow = -1;
@@ -286,8 +288,9 @@ int findBestGuess()
 			}
 		}
 	}
-	bestGuessRow = lowestRow;
-	bestGuessColumn = lowestColumn;
+	if (lowestRow == -1)
+		return -1;
+	return lowestRow * BOARD_SIZE + lowestColumn;
 }
 
 bool findSolution()
@@ -299,16 +302,15 @@ bool findSolution()
 		return true;
 	}
 	updateCandidates();
-	findBestGuess();
-	if (bestGuessRow == -1 || bestGuessColumn == -1)
+	int bestGuess = findBestGuess();
+	if (bestGuess == -1)
 	{
 		// there are no vacant spaces, so this is a dead end.
-		//cout << "Invalid guess (" << bestGuessColumn << ", " << bestGuessRow << ")" << endl;
 		return false;
 	}
 
-	int row = bestGuessRow;
-	int col = bestGuessColumn;
+	int row = bestGuess / BOARD_SIZE;
+	int col = bestGuess % BOARD_SIZE;
 	for (int x = 0; x < BOARD_SIZE; x++)
 	{
 		if (candidates[row][col][x] == 1)
@@ -368,163 +370,4428 @@ bool findSolution()
 }
 **/
 
-void loadTestBoard0()
+/**
+ * Search statistics.  A guess is a digit tried in a cell that had more than
+ * one candidate, a backtrack is a guess that was taken back, and a
+ * propagation is a digit placed or a candidate eliminated by inference.
+ * Guesses are always counted, since maxGuesses and the generator's grades
+ * depend on them; the other two are instrumentation only and compile out
+ * of release (NDEBUG) builds unless SUDOKU_COUNTERS is defined.
+ */
+#if !defined(NDEBUG) || defined(SUDOKU_COUNTERS)
+#define COUNT(counter, n) ((counter) += (n))
+const bool COUNTERS_ENABLED = true;
+#else
+#define COUNT(counter, n) ((void)(counter), (void)(n))
+const bool COUNTERS_ENABLED = false;
+#endif
+
+struct SolveStats
 {
-	int b[][9] =
+	long guesses;
+	long backtracks;
+	long propagations;
+};
+
+void clearStats(SolveStats& s)
+{
+	s.guesses = 0;
+	s.backtracks = 0;
+	s.propagations = 0;
+}
+
+void addStats(SolveStats& total, const SolveStats& s)
+{
+	total.guesses += s.guesses;
+	total.backtracks += s.backtracks;
+	total.propagations += s.propagations;
+}
+
+// Prints the summary line of a run, leaving out the counters that were compiled out.
+void printStats(ostream& out, const SolveStats& s)
+{
+	out << "Guesses: " << s.guesses;
+	if (COUNTERS_ENABLED)
+		out << ", backtracks: " << s.backtracks << ", propagations: " << s.propagations;
+	else
+		out << " (backtracks and propagations compiled out)";
+	out << endl;
+}
+
+/**
+ * Bitmask engine.
+ *
+ * Digit d is bit (d - 1) of a 9-bit mask.  Each row, column and box keeps the
+ * mask of digits it is still missing, and each cell keeps a 16-bit candidate
+ * word that is all digits while the cell is empty and zero once it is filled.
+ * The candidates of a cell are then just the AND of its four masks, and
+ * placing or removing a digit only touches the three unit masks and the cell
+ * itself instead of rebuilding everything.
+ */
+const int NUM_CELLS = BOARD_SIZE * BOARD_SIZE;
+const uint16_t ALL_DIGITS = (1 << BOARD_SIZE) - 1;
+
+struct BitBoard
+{
+	uint8_t cells[NUM_CELLS];
+	uint16_t cellMask[NUM_CELLS];
+	uint16_t rowFree[BOARD_SIZE];
+	uint16_t columnFree[BOARD_SIZE];
+	uint16_t boxFree[BOARD_SIZE];
+	int emptyCells;
+};
+
+inline int cellRow(int cell)
+{
+	return cell / BOARD_SIZE;
+}
+
+inline int cellColumn(int cell)
+{
+	return cell % BOARD_SIZE;
+}
+
+inline int cellBox(int cell)
+{
+	return (cellRow(cell) / 3) * 3 + cellColumn(cell) / 3;
+}
+
+inline uint16_t cellCandidates(const BitBoard& b, int cell)
+{
+	return b.rowFree[cellRow(cell)] & b.columnFree[cellColumn(cell)] & b.boxFree[cellBox(cell)] & b.cellMask[cell];
+}
+
+void clearBitBoard(BitBoard& b)
+{
+	for (int i = 0; i < NUM_CELLS; i++)
 	{
-		{0, 2, 0, 4, 5, 6, 7, 8, 9},
-		{4, 5, 6, 7, 8, 9, 1, 2, 3},
-		{7, 0, 0, 0, 2, 3, 0, 5, 6},
+		b.cells[i] = 0;
+		b.cellMask[i] = ALL_DIGITS;
+	}
+	for (int i = 0; i < BOARD_SIZE; i++)
+	{
+		b.rowFree[i] = ALL_DIGITS;
+		b.columnFree[i] = ALL_DIGITS;
+		b.boxFree[i] = ALL_DIGITS;
+	}
+	b.emptyCells = NUM_CELLS;
+}
 
-		{2, 3, 4, 5, 6, 7, 8, 9, 1},
-		{5, 6, 7, 8, 9, 1, 2, 3, 4},
-		{0, 0, 0, 0, 0, 0, 5, 6, 7},
+// Puts val in an empty cell.  The caller makes sure val is a candidate.
+inline void placeDigit(BitBoard& b, int cell, int val)
+{
+	uint16_t bit = 1 << (val - 1);
+	b.cells[cell] = val;
+	b.cellMask[cell] = 0;
+	b.rowFree[cellRow(cell)] &= ~bit;
+	b.columnFree[cellColumn(cell)] &= ~bit;
+	b.boxFree[cellBox(cell)] &= ~bit;
+	b.emptyCells--;
+}
 
-		{3, 4, 5, 6, 0, 8, 9, 1, 2},
-		{0, 7, 0, 9, 0, 2, 3, 4, 5},
-		{0, 1, 2, 3, 0, 5, 6, 7, 0}
-	};
+// Undoes placeDigit.
+inline void removeDigit(BitBoard& b, int cell)
+{
+	uint16_t bit = 1 << (b.cells[cell] - 1);
+	b.cells[cell] = 0;
+	b.cellMask[cell] = ALL_DIGITS;
+	b.rowFree[cellRow(cell)] |= bit;
+	b.columnFree[cellColumn(cell)] |= bit;
+	b.boxFree[cellBox(cell)] |= bit;
+	b.emptyCells++;
+}
 
+/**
+ * Fills a bit board from the global board.  Returns false if two of the
+ * clues already clash.
+ */
+bool loadBitBoard(BitBoard& b)
+{
+	clearBitBoard(b);
 	for (int j = 0; j < BOARD_SIZE; j++)
 	{
 		for (int i = 0; i < BOARD_SIZE; i++)
 		{
-			board[j][i] = b[j][i];
+			int cell = j * BOARD_SIZE + i;
+			int val = board[j][i];
+			if (val == 0)
+				continue;
+			if ((cellCandidates(b, cell) & (1 << (val - 1))) == 0)
+				return false;
+			placeDigit(b, cell, val);
 		}
 	}
+	return true;
 }
 
-void loadTestBoard1()
+// Copies a bit board back into the global board.
+void storeBitBoard(const BitBoard& b)
 {
-	int b[][9] =
-	{
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 0, 0, 0},
-		{0, 0, 0, 0, 0, 0, 0, 0, 0}
-	};
-
 	for (int j = 0; j < BOARD_SIZE; j++)
 	{
 		for (int i = 0; i < BOARD_SIZE; i++)
 		{
-			board[j][i] = b[j][i];
+			board[j][i] = b.cells[j * BOARD_SIZE + i];
 		}
 	}
 }
 
-void loadTestBoard2()
+/**
+ * Same search as findSolution: guess on the empty cell with the fewest
+ * candidates, except a cell with none left is a dead end straight away.
+ */
+bool findSolutionBitmask(BitBoard& b, SolveStats& stats)
 {
-	int b[][9] =
-	{
-		{5, 3, 0, 0, 7, 0, 0, 0, 0},
-		{6, 0, 0, 1, 9, 5, 0, 0, 0},
-		{0, 9, 8, 0, 0, 0, 0, 6, 0},
-
-		{8, 0, 0, 0, 6, 0, 0, 0, 3},
-		{4, 0, 0, 8, 0, 3, 0, 0, 1},
-		{7, 0, 0, 0, 2, 0, 0, 0, 6},
-
-		{0, 6, 0, 0, 0, 0, 2, 8, 0},
-		{0, 0, 0, 4, 1, 9, 0, 0, 5},
-		{0, 0, 0, 0, 8, 0, 0, 7, 9}
-	};
+	if (b.emptyCells == 0)
+		return true;
 
-	for (int j = 0; j < BOARD_SIZE; j++)
+	int best = -1;
+	int bestCount = BOARD_SIZE + 1;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
 	{
-		for (int i = 0; i < BOARD_SIZE; i++)
+		if (b.cells[cell] != 0)
+			continue;
+		int count = __builtin_popcount(cellCandidates(b, cell));
+		if (count < bestCount)
 		{
-			board[j][i] = b[j][i];
+			best = cell;
+			bestCount = count;
+			if (count <= 1)
+				break;
 		}
 	}
+	if (bestCount == 0)
+		return false;
+
+	uint16_t cands = cellCandidates(b, best);
+	while (cands != 0)
+	{
+		int val = __builtin_ctz(cands) + 1;
+		cands &= cands - 1;
+		if (bestCount > 1)
+			stats.guesses++;
+		placeDigit(b, best, val);
+		if (findSolutionBitmask(b, stats))
+			return true;
+		removeDigit(b, best);
+		if (bestCount > 1)
+			COUNT(stats.backtracks, 1);
+	}
+
+	return false;
 }
 
-void loadTestBoard3()
+/**
+ * Propagation engine.
+ *
+ * Before every guess the board is pushed to a fixpoint of naked singles,
+ * hidden singles and locked candidates (pointing and claiming).  Every change
+ * to the board goes on a trail first, as the cell and its old candidate word,
+ * so backing out of a guess pops the trail back to where it was instead of
+ * recomputing anything.  A cell is placed at most once and loses at most
+ * BOARD_SIZE candidates along one branch, which bounds the trail.
+ */
+struct TrailEntry
 {
-	int b[][9] =
-	{
-		{0, 2, 3, 4, 5, 6, 7, 8, 9},
-		{4, 5, 6, 7, 8, 9, 1, 2, 3},
-		{7, 8, 0, 1, 2, 3, 4, 5, 6},
+	uint8_t cell;
+	uint8_t placed;
+	uint16_t oldMask;
+};
 
-		{2, 3, 4, 5, 6, 7, 8, 9, 1},
-		{5, 6, 7, 8, 9, 1, 2, 3, 4},
-		{8, 9, 1, 2, 3, 4, 5, 6, 7},
+struct Trail
+{
+	TrailEntry entries[NUM_CELLS * (BOARD_SIZE + 1)];
+	int size;
+};
 
-		{3, 4, 5, 6, 7, 8, 9, 1, 2},
-		{6, 7, 8, 9, 1, 2, 3, 4, 5},
-		{9, 1, 2, 3, 4, 5, 6, 7, 8}
-	};
+const int NUM_UNITS = 3 * BOARD_SIZE;
 
-	for (int j = 0; j < BOARD_SIZE; j++)
+// Units 0-8 are the rows, 9-17 the columns and 18-26 the boxes.
+inline int unitCell(int unit, int k)
+{
+	if (unit < BOARD_SIZE)
+		return unit * BOARD_SIZE + k;
+	if (unit < 2 * BOARD_SIZE)
+		return k * BOARD_SIZE + (unit - BOARD_SIZE);
+	int box = unit - 2 * BOARD_SIZE;
+	return ((box / 3) * 3 + k / 3) * BOARD_SIZE + (box % 3) * 3 + k % 3;
+}
+
+inline uint16_t unitFree(const BitBoard& b, int unit)
+{
+	if (unit < BOARD_SIZE)
+		return b.rowFree[unit];
+	if (unit < 2 * BOARD_SIZE)
+		return b.columnFree[unit - BOARD_SIZE];
+	return b.boxFree[unit - 2 * BOARD_SIZE];
+}
+
+inline void trailPlace(BitBoard& b, Trail& t, int cell, int val)
+{
+	TrailEntry& e = t.entries[t.size++];
+	e.cell = cell;
+	e.placed = 1;
+	e.oldMask = b.cellMask[cell];
+	placeDigit(b, cell, val);
+}
+
+inline void trailEliminate(BitBoard& b, Trail& t, int cell, uint16_t bits)
+{
+	TrailEntry& e = t.entries[t.size++];
+	e.cell = cell;
+	e.placed = 0;
+	e.oldMask = b.cellMask[cell];
+	b.cellMask[cell] &= ~bits;
+}
+
+// Pops the trail back down to mark, undoing every change above it.
+void undoTrail(BitBoard& b, Trail& t, int mark)
+{
+	while (t.size > mark)
 	{
-		for (int i = 0; i < BOARD_SIZE; i++)
+		TrailEntry& e = t.entries[--t.size];
+		if (e.placed)
 		{
-			board[j][i] = b[j][i];
+			int cell = e.cell;
+			uint16_t bit = 1 << (b.cells[cell] - 1);
+			b.cells[cell] = 0;
+			b.rowFree[cellRow(cell)] |= bit;
+			b.columnFree[cellColumn(cell)] |= bit;
+			b.boxFree[cellBox(cell)] |= bit;
+			b.emptyCells++;
 		}
+		b.cellMask[e.cell] = e.oldMask;
 	}
 }
 
-int main(int argc, char** argv)
+/**
+ * Removes the digits in bits from every empty cell of a unit, except the
+ * cells whose position in the unit is flagged in keep.  Returns true if
+ * anything was eliminated.
+ */
+template <typename TrailType>
+bool eliminateFromUnit(BitBoard& b, TrailType& t, SolveStats& stats, int unit, int keep, uint16_t bits)
 {
-	board = new int*[BOARD_SIZE];
-	for (int j = 0; j < BOARD_SIZE; j++)
+	bool changed = false;
+	for (int k = 0; k < BOARD_SIZE; k++)
 	{
-		board[j] = new int[BOARD_SIZE];
-		for (int i = 0; i < BOARD_SIZE; i++)
+		if (keep & (1 << k))
+			continue;
+		int cell = unitCell(unit, k);
+		uint16_t hit = cellCandidates(b, cell) & bits;
+		if (hit != 0)
 		{
-			board[j][i] = 0;
+			trailEliminate(b, t, cell, hit);
+			COUNT(stats.propagations, 1);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+/**
+ * Locked candidates.  For every box, if a digit's candidates within it all
+ * lie on one row (or column) of the box, the digit is eliminated from the
+ * rest of that row (pointing).  Going the other way, if a row's (or column's)
+ * candidates for a digit all lie within one box, the digit is eliminated from
+ * the rest of that box (claiming).  Returns true if anything was eliminated.
+ */
+template <typename TrailType>
+bool findLockedCandidates(BitBoard& b, TrailType& t, SolveStats& stats)
+{
+	bool changed = false;
+	for (int box = 0; box < BOARD_SIZE; box++)
+	{
+		int boxUnit = 2 * BOARD_SIZE + box;
+		uint16_t rowPart[3], columnPart[3];
+		for (int k = 0; k < 3; k++)
+		{
+			rowPart[k] = 0;
+			columnPart[k] = 0;
+		}
+		for (int k = 0; k < BOARD_SIZE; k++)
+		{
+			uint16_t c = cellCandidates(b, unitCell(boxUnit, k));
+			rowPart[k / 3] |= c;
+			columnPart[k % 3] |= c;
+		}
+
+		int top = (box / 3) * 3;
+		int left = (box % 3) * 3;
+		for (int k = 0; k < 3; k++)
+		{
+			// positions of this box within the row or column being cleared.
+			int rowKeep = 7 << left;
+			int columnKeep = 7 << top;
+
+			uint16_t rowPointing = rowPart[k] & ~(rowPart[(k + 1) % 3] | rowPart[(k + 2) % 3]);
+			if (rowPointing != 0)
+				changed |= eliminateFromUnit(b, t, stats, top + k, rowKeep, rowPointing);
+
+			uint16_t columnPointing = columnPart[k] & ~(columnPart[(k + 1) % 3] | columnPart[(k + 2) % 3]);
+			if (columnPointing != 0)
+				changed |= eliminateFromUnit(b, t, stats, BOARD_SIZE + left + k, columnKeep, columnPointing);
 		}
 	}
 
-	candidates = new int**[BOARD_SIZE];
-	for (int k = 0; k < BOARD_SIZE; k++)
+	for (int line = 0; line < 2 * BOARD_SIZE; line++)
 	{
-		candidates[k] = new int*[BOARD_SIZE];
-		for (int j = 0; j < BOARD_SIZE; j++)
+		uint16_t part[3] = {0, 0, 0};
+		for (int k = 0; k < BOARD_SIZE; k++)
 		{
-			candidates[k][j] = new int[BOARD_SIZE];
-			for (int i = 0; i < BOARD_SIZE; i++)
+			part[k / 3] |= cellCandidates(b, unitCell(line, k));
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			uint16_t claiming = part[k] & ~(part[(k + 1) % 3] | part[(k + 2) % 3]);
+			if (claiming == 0)
+				continue;
+
+			// keep the three cells of the box that lie on this line.
+			int box, keep;
+			if (line < BOARD_SIZE)
 			{
-				candidates[k][j][i] = 1;
+				box = (line / 3) * 3 + k;
+				keep = 7 << ((line % 3) * 3);
+			}else
+			{
+				int column = line - BOARD_SIZE;
+				box = k * 3 + column / 3;
+				keep = 0111 << (column % 3);
 			}
+			changed |= eliminateFromUnit(b, t, stats, 2 * BOARD_SIZE + box, keep, claiming);
 		}
 	}
 
-	loadTestBoard2();
-	updateCandidates();
+	return changed;
+}
 
-	/**
-	for (int j = 7; j < BOARD_SIZE; j++)
+// Told which unit a contradiction turned up in.  Only the learning search
+// listens; for every other trail type this compiles away.
+template <typename TrailType>
+inline void noteConflict(TrailType&, int)
+{
+}
+
+/**
+ * Pushes the board to a fixpoint of naked singles, hidden singles and, if
+ * lockedCandidates is set, locked candidates, in that order of preference.
+ * Returns false on a contradiction: an empty cell with no candidates, or a
+ * unit with nowhere left to put one of its missing digits.  The trail type
+ * is either a Trail or, for a board that gets thrown away on failure, a
+ * NoTrail.
+ */
+template <typename TrailType>
+bool propagate(BitBoard& b, TrailType& t, SolveStats& stats, bool lockedCandidates)
+{
+	while (b.emptyCells > 0)
 	{
-		for (int i = 0; i < 3; i++)
+		bool changed = false;
+
+		// naked singles
+		for (int cell = 0; cell < NUM_CELLS; cell++)
 		{
-			cout << "Candidates for (" << i << ", " << j << "):" << endl;
-			for (int x = 0; x < BOARD_SIZE; x++)
+			if (b.cells[cell] != 0)
+				continue;
+			uint16_t c = cellCandidates(b, cell);
+			if (c == 0)
 			{
-				if (candidates[j][i][x] == 1)
-				{
-					cout << (x + 1) << " ";
-				}else
+				noteConflict(t, cellRow(cell));
+				noteConflict(t, BOARD_SIZE + cellColumn(cell));
+				noteConflict(t, 2 * BOARD_SIZE + cellBox(cell));
+				return false;
+			}
+			if ((c & (c - 1)) == 0)
+			{
+				trailPlace(b, t, cell, __builtin_ctz(c) + 1);
+				COUNT(stats.propagations, 1);
+				changed = true;
+			}
+		}
+		if (changed)
+			continue;
+
+		// hidden singles
+		for (int unit = 0; unit < NUM_UNITS; unit++)
+		{
+			uint16_t once = 0;
+			uint16_t twice = 0;
+			for (int k = 0; k < BOARD_SIZE; k++)
+			{
+				uint16_t c = cellCandidates(b, unitCell(unit, k));
+				twice |= once & c;
+				once |= c;
+			}
+			uint16_t free = unitFree(b, unit);
+			if ((free & ~once) != 0)
+			{
+				noteConflict(t, unit);
+				return false;
+			}
+
+			uint16_t hidden = once & ~twice;
+			while (hidden != 0)
+			{
+				uint16_t bit = hidden & (0 - hidden);
+				hidden ^= bit;
+				int k = 0;
+				while (k < BOARD_SIZE && (cellCandidates(b, unitCell(unit, k)) & bit) == 0)
+					k++;
+				if (k == BOARD_SIZE)
 				{
-					cout << "X ";
+					// an earlier single in this unit may have taken the digit
+					// already, otherwise one elsewhere took away its last place.
+					if (unitFree(b, unit) & bit)
+					{
+						noteConflict(t, unit);
+						return false;
+					}
+					continue;
 				}
+				trailPlace(b, t, unitCell(unit, k), __builtin_ctz(bit) + 1);
+				COUNT(stats.propagations, 1);
+				changed = true;
 			}
-			cout << endl;
 		}
+		if (changed)
+			continue;
+
+		if (!lockedCandidates || !findLockedCandidates(b, t, stats))
+			break;
 	}
-	**/
 
-	//findBestGuess();
-	findSolution();
+	return true;
+}
 
-	return 0;
+/**
+ * Returns the empty cell with the fewest candidates on a board that has
+ * been propagated, so has no cell with fewer than two.
+ */
+int findBestCell(const BitBoard& b)
+{
+	int best = -1;
+	int bestCount = BOARD_SIZE + 1;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if (b.cells[cell] != 0)
+			continue;
+		int count = __builtin_popcount(cellCandidates(b, cell));
+		if (count < bestCount)
+		{
+			best = cell;
+			bestCount = count;
+			if (count == 2)
+				break;
+		}
+	}
+	return best;
+}
+
+/**
+ * Propagates, then guesses on the empty cell with the fewest candidates.
+ * On failure the board is left exactly as it was found.
+ */
+bool findSolutionPropagate(BitBoard& b, Trail& t, SolveStats& stats)
+{
+	int mark = t.size;
+	if (!propagate(b, t, stats, true))
+	{
+		undoTrail(b, t, mark);
+		return false;
+	}
+	if (b.emptyCells == 0)
+		return true;
+
+	int best = findBestCell(b);
+	uint16_t cands = cellCandidates(b, best);
+	while (cands != 0)
+	{
+		int val = __builtin_ctz(cands) + 1;
+		cands &= cands - 1;
+		int guessMark = t.size;
+		stats.guesses++;
+		trailPlace(b, t, best, val);
+		if (findSolutionPropagate(b, t, stats))
+			return true;
+		undoTrail(b, t, guessMark);
+		COUNT(stats.backtracks, 1);
+	}
+
+	undoTrail(b, t, mark);
+	return false;
 }
 
+/**
+ * Learning engine.
+ *
+ * Chronological backtracking rediscovers the same dead ends over and over,
+ * so this search remembers them.  Every refuted guess leaves a nogood: the
+ * guesses above it plus the refuted one, which can never all hold at once.
+ * Nogoods are checked after propagation, where one with every literal but
+ * one true rules the last one out and one with all of them true is a
+ * contradiction.  They pay off after a restart, which the search takes
+ * whenever it has failed a Luby sequence's worth of times since the last
+ * one, keeping its nogoods and branching weights.  Branching is dom/wdeg:
+ * every contradiction propagation finds adds weight to the unit it was in,
+ * and the search guesses on the cell with the fewest candidates per unit
+ * of weight around it.  Nogoods longer than MAX_NOGOOD_SIZE aren't kept,
+ * and once there are more than MAX_NOGOODS the less active half is dropped.
+ */
+const int MAX_NOGOOD_SIZE = 24;
+const size_t MAX_NOGOODS = 2000;
+const long RESTART_FAILURES = 32;
+
+enum LearnResult { LEARN_FAILED, LEARN_SOLVED, LEARN_RESTART };
+
+struct Nogood
+{
+	int size;
+	uint8_t cells[MAX_NOGOOD_SIZE];
+	uint8_t vals[MAX_NOGOOD_SIZE];
+	// how often it has pruned since the database was last cut down.
+	long activity;
+};
+
+struct LearningTrail : Trail
+{
+	long weights[NUM_UNITS];
+};
+
+inline void noteConflict(LearningTrail& t, int unit)
+{
+	t.weights[unit]++;
+}
+
+struct Learner
+{
+	LearningTrail trail;
+	vector<Nogood> nogoods;
+	int decisionCells[NUM_CELLS];
+	uint8_t decisionVals[NUM_CELLS];
+	int depth;
+	long failures;
+	long restartAt;
+};
+
+// Returns term i (from 0) of the Luby sequence 1 1 2 1 1 2 4 1 1 2 ...
+long luby(long i)
+{
+	long size = 1;
+	int seq = 0;
+	while (size < i + 1)
+	{
+		seq++;
+		size = 2 * size + 1;
+	}
+	while (size - 1 != i)
+	{
+		size = (size - 1) >> 1;
+		seq--;
+		i = i % size;
+	}
+	return 1L << seq;
+}
+
+bool moreActive(const Nogood& a, const Nogood& b)
+{
+	return a.activity > b.activity;
+}
+
+// Records that the current guesses plus cell = val can't all hold.
+void learnNogood(Learner& l, int cell, int val)
+{
+	if (l.depth + 1 > MAX_NOGOOD_SIZE)
+		return;
+	Nogood n;
+	n.size = l.depth + 1;
+	for (int i = 0; i < l.depth; i++)
+	{
+		n.cells[i] = l.decisionCells[i];
+		n.vals[i] = l.decisionVals[i];
+	}
+	n.cells[l.depth] = cell;
+	n.vals[l.depth] = val;
+	n.activity = 0;
+	l.nogoods.push_back(n);
+
+	if (l.nogoods.size() > MAX_NOGOODS)
+	{
+		stable_sort(l.nogoods.begin(), l.nogoods.end(), moreActive);
+		l.nogoods.resize(MAX_NOGOODS / 2);
+		for (size_t i = 0; i < l.nogoods.size(); i++)
+			l.nogoods[i].activity /= 2;
+	}
+}
+
+/**
+ * Propagates to a fixpoint of the usual inference and the nogoods.
+ * Returns false on a contradiction.
+ */
+bool propagateLearned(BitBoard& b, Learner& l, SolveStats& stats)
+{
+	while (true)
+	{
+		if (!propagate(b, l.trail, stats, true))
+			return false;
+
+		bool changed = false;
+		for (size_t i = 0; i < l.nogoods.size(); i++)
+		{
+			Nogood& n = l.nogoods[i];
+			int open = -1;
+			bool satisfied = false;
+			for (int k = 0; k < n.size && !satisfied; k++)
+			{
+				int cell = n.cells[k];
+				if (b.cells[cell] == n.vals[k])
+					continue;
+				if (b.cells[cell] != 0 || (cellCandidates(b, cell) & (1 << (n.vals[k] - 1))) == 0)
+					satisfied = true;
+				else if (open >= 0)
+					satisfied = true;
+				else
+					open = k;
+			}
+			if (satisfied)
+				continue;
+
+			n.activity++;
+			if (open < 0)
+				return false;
+			trailEliminate(b, l.trail, n.cells[open], 1 << (n.vals[open] - 1));
+			COUNT(stats.propagations, 1);
+			changed = true;
+		}
+		if (!changed)
+			return true;
+	}
+}
+
+// Returns the empty cell with the lowest ratio of candidates to weight.
+int findWeightedCell(const BitBoard& b, const long* weights)
+{
+	int best = -1;
+	long bestCount = 0;
+	long bestWeight = 1;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if (b.cells[cell] != 0)
+			continue;
+		long count = __builtin_popcount(cellCandidates(b, cell));
+		long weight = weights[cellRow(cell)] + weights[BOARD_SIZE + cellColumn(cell)]
+			+ weights[2 * BOARD_SIZE + cellBox(cell)];
+		if (best < 0 || count * bestWeight < bestCount * weight)
+		{
+			best = cell;
+			bestCount = count;
+			bestWeight = weight;
+		}
+	}
+	return best;
+}
+
+/**
+ * Searches below the current guesses with two-way branching: guess a digit
+ * in the chosen cell, and if that fails, learn from it, rule the digit out
+ * and carry on from the same node.  On failure or restart the board is left
+ * as it was found.
+ */
+int searchLearning(BitBoard& b, Learner& l, SolveStats& stats)
+{
+	int mark = l.trail.size;
+	while (true)
+	{
+		if (!propagateLearned(b, l, stats))
+		{
+			undoTrail(b, l.trail, mark);
+			return LEARN_FAILED;
+		}
+		if (b.emptyCells == 0)
+			return LEARN_SOLVED;
+		if (l.failures >= l.restartAt)
+		{
+			undoTrail(b, l.trail, mark);
+			return LEARN_RESTART;
+		}
+
+		int cell = findWeightedCell(b, l.trail.weights);
+		int val = __builtin_ctz(cellCandidates(b, cell)) + 1;
+		int guessMark = l.trail.size;
+		stats.guesses++;
+		l.decisionCells[l.depth] = cell;
+		l.decisionVals[l.depth] = val;
+		l.depth++;
+		trailPlace(b, l.trail, cell, val);
+
+		int result = searchLearning(b, l, stats);
+		if (result == LEARN_SOLVED)
+			return LEARN_SOLVED;
+		l.depth--;
+		undoTrail(b, l.trail, guessMark);
+		if (result == LEARN_RESTART)
+		{
+			undoTrail(b, l.trail, mark);
+			return LEARN_RESTART;
+		}
+
+		COUNT(stats.backtracks, 1);
+		l.failures++;
+		learnNogood(l, cell, val);
+		trailEliminate(b, l.trail, cell, 1 << (val - 1));
+	}
+}
+
+/**
+ * Solves b with the learning search, restarting on the Luby sequence times
+ * RESTART_FAILURES failures.
+ */
+bool findSolutionLearning(BitBoard& b, SolveStats& stats)
+{
+	Learner* l = new Learner;
+	l->trail.size = 0;
+	for (int unit = 0; unit < NUM_UNITS; unit++)
+		l->trail.weights[unit] = 1;
+	l->depth = 0;
+	l->failures = 0;
+
+	int result = LEARN_RESTART;
+	for (long run = 0; result == LEARN_RESTART; run++)
+	{
+		l->restartAt = l->failures + luby(run) * RESTART_FAILURES;
+		result = searchLearning(b, *l, stats);
+	}
+	delete l;
+	return result == LEARN_SOLVED;
+}
+
+/**
+ * Reentrant solver.
+ *
+ * Everything a solve needs lives in a BitBoard, which is a fixed-size value:
+ * each guess propagates on its own copy of the board, so there's nothing to
+ * undo, nothing shared between calls and nothing allocated.  The one
+ * exception is counting on more than one thread, which builds work lists
+ * and starts threads.  This is what the C interface in sudoku.h wraps.
+ */
+struct NoTrail
+{
+};
+
+inline void trailPlace(BitBoard& b, NoTrail&, int cell, int val)
+{
+	placeDigit(b, cell, val);
+}
+
+inline void trailEliminate(BitBoard& b, NoTrail&, int cell, uint16_t bits)
+{
+	b.cellMask[cell] &= ~bits;
+}
+
+struct SolveOptions
+{
+	// use locked candidates as well as singles.
+	bool lockedCandidates;
+	// give up after this many guesses, or never if 0.
+	long maxGuesses;
+	// threads countSolutions splits a puzzle across, or 0 for one per core;
+	// anything but 1 allocates and starts threads.
+	int threads;
+};
+
+void setDefaultOptions(SolveOptions& options)
+{
+	options.lockedCandidates = true;
+	options.maxGuesses = 0;
+	options.threads = 1;
+}
+
+/**
+ * Solves b, which the caller no longer needs, into out.  Returns one of the
+ * SUDOKU_ results.
+ */
+int searchCopies(BitBoard& b, const SolveOptions& options, SolveStats& stats, uint8_t* out)
+{
+	NoTrail t;
+	if (!propagate(b, t, stats, options.lockedCandidates))
+		return SUDOKU_UNSOLVABLE;
+	if (b.emptyCells == 0)
+	{
+		memcpy(out, b.cells, NUM_CELLS);
+		return SUDOKU_SOLVED;
+	}
+
+	int best = findBestCell(b);
+	uint16_t cands = cellCandidates(b, best);
+	while (cands != 0)
+	{
+		if (options.maxGuesses != 0 && stats.guesses >= options.maxGuesses)
+			return SUDOKU_GAVE_UP;
+
+		int val = __builtin_ctz(cands) + 1;
+		cands &= cands - 1;
+		stats.guesses++;
+
+		// the last guess can have b itself.
+		BitBoard child;
+		BitBoard& guess = (cands != 0) ? child : b;
+		if (cands != 0)
+			child = b;
+		placeDigit(guess, best, val);
+		int result = searchCopies(guess, options, stats, out);
+		if (result != SUDOKU_UNSOLVABLE)
+			return result;
+		COUNT(stats.backtracks, 1);
+	}
+	return SUDOKU_UNSOLVABLE;
+}
+
+// Fills b from a puzzle.  Returns false if a clue is out of range or clashes.
+bool loadClues(BitBoard& b, const uint8_t in[NUM_CELLS])
+{
+	clearBitBoard(b);
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if (in[cell] == 0)
+			continue;
+		if (in[cell] > BOARD_SIZE || (cellCandidates(b, cell) & (1 << (in[cell] - 1))) == 0)
+			return false;
+		placeDigit(b, cell, in[cell]);
+	}
+	return true;
+}
+
+/**
+ * Solves the puzzle in (0 for an empty cell) into out.  stats, if given, is
+ * added to.  Safe to call from any number of threads at once.
+ */
+int solve(const uint8_t in[NUM_CELLS], uint8_t out[NUM_CELLS], SolveOptions options, SolveStats* stats)
+{
+	BitBoard b;
+	if (!loadClues(b, in))
+		return SUDOKU_INVALID;
+
+	SolveStats local;
+	clearStats(local);
+	int result = searchCopies(b, options, local, out);
+	if (stats != 0)
+		addStats(*stats, local);
+	return result;
+}
+
+/**
+ * Counting.
+ *
+ * Counting walks the same copy-per-guess tree as solve, but carries on past
+ * the first solution until limit of them have turned up (or all of them,
+ * for a limit of 0).  Nothing is shared between subtrees: the boards below
+ * two digits guessed in a cell differ in that cell, so no board turns up
+ * twice in one count and remembering dead ends would never pay.  The only
+ * pruning is stopping early: a limit of 2 proves uniqueness as soon as a
+ * second solution appears, and when a puzzle is split across threads the
+ * first worker to reach the cap raises a shared flag that ends every other
+ * worker's search too.
+ */
+const int SPLIT_PER_THREAD = 8;
+const int MAX_SPLIT_DEPTH = 6;
+
+/**
+ * Counts the solutions below b, which the caller no longer needs, up to
+ * limit (0 for no limit), walking every subtree until then.  Gives up early
+ * once stop is raised.
+ */
+long countCopies(BitBoard& b, const SolveOptions& options, SolveStats& stats, long limit, const atomic<bool>* stop)
+{
+	if (stop != 0 && stop->load(memory_order_relaxed))
+		return 0;
+
+	NoTrail t;
+	if (!propagate(b, t, stats, options.lockedCandidates))
+		return 0;
+	if (b.emptyCells == 0)
+		return 1;
+
+	long found = 0;
+	int best = findBestCell(b);
+	uint16_t cands = cellCandidates(b, best);
+	while (cands != 0)
+	{
+		int val = __builtin_ctz(cands) + 1;
+		cands &= cands - 1;
+		stats.guesses++;
+
+		BitBoard child;
+		BitBoard& guess = (cands != 0) ? child : b;
+		if (cands != 0)
+			child = b;
+		placeDigit(guess, best, val);
+		found += countCopies(guess, options, stats, (limit == 0) ? 0 : limit - found, stop);
+		if (limit != 0 && found >= limit)
+			break;
+		COUNT(stats.backtracks, 1);
+	}
+	return found;
+}
+
+struct CountJob
+{
+	vector<BitBoard> boards;
+	atomic<size_t> next;
+	atomic<long> found;
+	atomic<bool> stop;
+	long limit;
+	SolveOptions options;
+	mutex statsLock;
+	SolveStats stats;
+};
+
+void countWorker(CountJob* job)
+{
+	SolveStats stats;
+	clearStats(stats);
+	while (!job->stop.load())
+	{
+		size_t i = job->next.fetch_add(1);
+		if (i >= job->boards.size())
+			break;
+		long remaining = (job->limit == 0) ? 0 : job->limit - job->found.load();
+		if (job->limit != 0 && remaining <= 0)
+			break;
+		long n = countCopies(job->boards[i], job->options, stats, remaining, &job->stop);
+		if (job->found.fetch_add(n) + n >= job->limit && job->limit != 0)
+			job->stop = true;
+	}
+
+	lock_guard<mutex> lock(job->statsLock);
+	addStats(job->stats, stats);
+}
+
+/**
+ * Counts the solutions of the puzzle in, up to limit (0 for no limit), or
+ * returns SUDOKU_INVALID if its clues are out of range or clash.  With more
+ * than one thread in the options, the first few levels of guesses are
+ * expanded breadth first into a list of subtrees that the threads then
+ * share out.
+ */
+long countSolutions(const uint8_t in[NUM_CELLS], long limit, SolveOptions options, SolveStats* stats)
+{
+	BitBoard b;
+	if (!loadClues(b, in))
+		return SUDOKU_INVALID;
+
+	int numThreads = options.threads;
+	if (numThreads == 0)
+		numThreads = max(1u, thread::hardware_concurrency());
+
+	SolveStats local;
+	clearStats(local);
+	long found = 0;
+	if (numThreads == 1)
+	{
+		found = countCopies(b, options, local, limit, 0);
+		if (stats != 0)
+			addStats(*stats, local);
+		return found;
+	}
+
+	CountJob job;
+	job.boards.push_back(b);
+	for (int depth = 0; depth < MAX_SPLIT_DEPTH && job.boards.size() < (size_t)numThreads * SPLIT_PER_THREAD; depth++)
+	{
+		vector<BitBoard> next;
+		NoTrail t;
+		for (size_t i = 0; i < job.boards.size(); i++)
+		{
+			BitBoard& board = job.boards[i];
+			if (!propagate(board, t, local, options.lockedCandidates))
+				continue;
+			if (board.emptyCells == 0)
+			{
+				found++;
+				continue;
+			}
+			int best = findBestCell(board);
+			for (uint16_t cands = cellCandidates(board, best); cands != 0; cands &= cands - 1)
+			{
+				local.guesses++;
+				next.push_back(board);
+				placeDigit(next.back(), best, __builtin_ctz(cands) + 1);
+			}
+		}
+		job.boards.swap(next);
+		if (job.boards.empty() || (limit != 0 && found >= limit))
+			break;
+	}
+
+	if (limit == 0 || found < limit)
+	{
+		job.next = 0;
+		job.found = found;
+		job.stop = false;
+		job.limit = limit;
+		job.options = options;
+		clearStats(job.stats);
+
+		vector<thread> workers;
+		for (int t = 1; t < numThreads; t++)
+			workers.push_back(thread(countWorker, &job));
+		countWorker(&job);
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+
+		found = job.found;
+		addStats(local, job.stats);
+	}
+
+	if (stats != 0)
+		addStats(*stats, local);
+	return (limit != 0) ? min(found, limit) : found;
+}
+
+extern "C" void sudoku_default_options(sudoku_options* options)
+{
+	SolveOptions o;
+	setDefaultOptions(o);
+	options->locked_candidates = o.lockedCandidates ? 1 : 0;
+	options->max_guesses = o.maxGuesses;
+	options->threads = o.threads;
+}
+
+SolveOptions fromCOptions(const sudoku_options* options)
+{
+	SolveOptions o;
+	setDefaultOptions(o);
+	if (options != 0)
+	{
+		o.lockedCandidates = options->locked_candidates != 0;
+		o.maxGuesses = options->max_guesses;
+		o.threads = options->threads;
+	}
+	return o;
+}
+
+void toCStats(const SolveStats& s, sudoku_stats* stats)
+{
+	if (stats != 0)
+	{
+		stats->guesses = s.guesses;
+		stats->backtracks = s.backtracks;
+		stats->propagations = s.propagations;
+	}
+}
+
+extern "C" int sudoku_solve(const uint8_t in[81], uint8_t out[81], const sudoku_options* options, sudoku_stats* stats)
+{
+	SolveStats s;
+	clearStats(s);
+	int result = solve(in, out, fromCOptions(options), &s);
+	toCStats(s, stats);
+	return result;
+}
+
+extern "C" long sudoku_count(const uint8_t in[81], long cap, const sudoku_options* options, sudoku_stats* stats)
+{
+	SolveStats s;
+	clearStats(s);
+	long result = countSolutions(in, cap, fromCOptions(options), &s);
+	toCStats(s, stats);
+	return result;
+}
+
+/**
+ * Vector engine.
+ *
+ * The same naked and hidden singles as the propagation engine, but with the
+ * candidates of the whole board computed at once on packed 16-bit lanes.
+ * Every unit is laid out three ways, each as nine vectors of one lane per
+ * unit: row-major (vector per row, lane per column), column-major (vector
+ * per column, lane per row) and box-major (vector per position in the box,
+ * lane per box).  Accumulating down the nine vectors of a layout then finds
+ * the hidden singles of its units in every lane at once, so a single pass
+ * covers all 27 units.  Lanes 9-15 are padding and always zero.
+ *
+ * A unit's free mask shows up in different lanes in each layout.  Rather
+ * than shuffling on every pass, the board keeps those expanded copies of the
+ * free masks up to date on every placement, which only touches scalars.
+ */
+const int LANES = 16;
+
+struct alignas(32) VectorBoard
+{
+	// cell masks: all digits while empty, zero once filled.
+	uint16_t rowMajor[BOARD_SIZE][LANES];
+	uint16_t columnMajor[BOARD_SIZE][LANES];
+	uint16_t boxMajor[BOARD_SIZE][LANES];
+
+	// free masks, lane per unit.
+	uint16_t rowFree[LANES];
+	uint16_t columnFree[LANES];
+	uint16_t boxFree[LANES];
+
+	// lane c of bandBoxes[i] is the free mask of the box over column c in band i.
+	uint16_t bandBoxes[3][LANES];
+	// lane r of stackBoxes[i] is the free mask of the box beside row r in stack i.
+	uint16_t stackBoxes[3][LANES];
+	// lane b of boxRows[i] is the free mask of row i of box b.
+	uint16_t boxRows[3][LANES];
+	// lane b of boxColumns[i] is the free mask of column i of box b.
+	uint16_t boxColumns[3][LANES];
+
+	uint8_t cells[NUM_CELLS];
+	int emptyCells;
+};
+
+// The result of one pass over the board.
+struct alignas(32) Evaluation
+{
+	uint16_t candidates[BOARD_SIZE][LANES];
+	uint16_t hiddenInRow[LANES];
+	uint16_t hiddenInColumn[LANES];
+	uint16_t hiddenInBox[LANES];
+	// bit 2c of naked[r] is set if (r, c) is a naked single.
+	uint32_t naked[BOARD_SIZE];
+	int best;
+};
+
+struct VectorTrail
+{
+	uint8_t cells[NUM_CELLS];
+	int size;
+};
+
+void clearVectorBoard(VectorBoard& b)
+{
+	memset(&b, 0, sizeof(b));
+	for (int i = 0; i < BOARD_SIZE; i++)
+	{
+		for (int j = 0; j < BOARD_SIZE; j++)
+		{
+			b.rowMajor[i][j] = ALL_DIGITS;
+			b.columnMajor[i][j] = ALL_DIGITS;
+			b.boxMajor[i][j] = ALL_DIGITS;
+		}
+		b.rowFree[i] = ALL_DIGITS;
+		b.columnFree[i] = ALL_DIGITS;
+		b.boxFree[i] = ALL_DIGITS;
+		for (int k = 0; k < 3; k++)
+		{
+			b.bandBoxes[k][i] = ALL_DIGITS;
+			b.stackBoxes[k][i] = ALL_DIGITS;
+			b.boxRows[k][i] = ALL_DIGITS;
+			b.boxColumns[k][i] = ALL_DIGITS;
+		}
+	}
+	b.emptyCells = NUM_CELLS;
+}
+
+inline uint16_t vectorCandidates(const VectorBoard& b, int row, int col)
+{
+	return b.rowFree[row] & b.columnFree[col] & b.boxFree[(row / 3) * 3 + col / 3] & b.rowMajor[row][col];
+}
+
+/**
+ * Sets or clears the digit bits in the masks of a cell and its units.  With
+ * place true the bits are taken out of the free masks and the cell is
+ * filled; with it false they go back in and the cell is emptied.
+ */
+inline void updateVectorBoard(VectorBoard& b, int row, int col, uint16_t bit, bool place)
+{
+	int box = (row / 3) * 3 + col / 3;
+	int k = (row % 3) * 3 + col % 3;
+	uint16_t cellMask = place ? 0 : ALL_DIGITS;
+	b.rowMajor[row][col] = cellMask;
+	b.columnMajor[col][row] = cellMask;
+	b.boxMajor[k][box] = cellMask;
+
+	uint16_t keep = place ? (uint16_t)~bit : 0xFFFF;
+	uint16_t add = place ? 0 : bit;
+	b.rowFree[row] = (b.rowFree[row] & keep) | add;
+	b.columnFree[col] = (b.columnFree[col] & keep) | add;
+	b.boxFree[box] = (b.boxFree[box] & keep) | add;
+	for (int j = 0; j < 3; j++)
+	{
+		uint16_t& boxRow = b.boxRows[row % 3][(row / 3) * 3 + j];
+		boxRow = (boxRow & keep) | add;
+		uint16_t& boxColumn = b.boxColumns[col % 3][j * 3 + col / 3];
+		boxColumn = (boxColumn & keep) | add;
+		uint16_t& bandBox = b.bandBoxes[box / 3][(box % 3) * 3 + j];
+		bandBox = (bandBox & keep) | add;
+		uint16_t& stackBox = b.stackBoxes[box % 3][(box / 3) * 3 + j];
+		stackBox = (stackBox & keep) | add;
+	}
+}
+
+inline void placeVector(VectorBoard& b, VectorTrail& t, int cell, int val)
+{
+	b.cells[cell] = val;
+	b.emptyCells--;
+	updateVectorBoard(b, cellRow(cell), cellColumn(cell), 1 << (val - 1), true);
+	t.cells[t.size++] = cell;
+}
+
+void undoVectorTrail(VectorBoard& b, VectorTrail& t, int mark)
+{
+	while (t.size > mark)
+	{
+		int cell = t.cells[--t.size];
+		updateVectorBoard(b, cellRow(cell), cellColumn(cell), 1 << (b.cells[cell] - 1), false);
+		b.cells[cell] = 0;
+		b.emptyCells++;
+	}
+}
+
+/**
+ * One pass over the board in plain scalar code, the fallback for CPUs
+ * without AVX2.  Returns false on a contradiction: an empty cell with no
+ * candidates, or a unit with nowhere to put one of its missing digits.
+ */
+bool evaluateScalar(const VectorBoard& b, Evaluation& e)
+{
+	int bestKey = 0xFFFF;
+	for (int r = 0; r < BOARD_SIZE; r++)
+	{
+		e.naked[r] = 0;
+		for (int c = 0; c < LANES; c++)
+		{
+			uint16_t cand = (c < BOARD_SIZE) ? vectorCandidates(b, r, c) : 0;
+			e.candidates[r][c] = cand;
+			if (c >= BOARD_SIZE || b.rowMajor[r][c] == 0)
+				continue;
+			int count = __builtin_popcount(cand);
+			if (count == 0)
+				return false;
+			if (count == 1)
+				e.naked[r] |= 1u << (2 * c);
+			bestKey = min(bestKey, (count << 8) | (r << 4) | c);
+		}
+	}
+	e.best = (bestKey == 0xFFFF) ? -1 : ((bestKey >> 4) & 15) * BOARD_SIZE + (bestKey & 15);
+
+	for (int u = 0; u < LANES; u++)
+	{
+		e.hiddenInRow[u] = 0;
+		e.hiddenInColumn[u] = 0;
+		e.hiddenInBox[u] = 0;
+	}
+	for (int u = 0; u < BOARD_SIZE; u++)
+	{
+		uint16_t once[3] = {0, 0, 0};
+		uint16_t twice[3] = {0, 0, 0};
+		for (int k = 0; k < BOARD_SIZE; k++)
+		{
+			uint16_t cands[3] =
+			{
+				e.candidates[u][k],
+				e.candidates[k][u],
+				e.candidates[(u / 3) * 3 + k / 3][(u % 3) * 3 + k % 3]
+			};
+			for (int type = 0; type < 3; type++)
+			{
+				twice[type] |= once[type] & cands[type];
+				once[type] |= cands[type];
+			}
+		}
+		if ((b.rowFree[u] & ~once[0]) || (b.columnFree[u] & ~once[1]) || (b.boxFree[u] & ~once[2]))
+			return false;
+		e.hiddenInRow[u] = once[0] & ~twice[0];
+		e.hiddenInColumn[u] = once[1] & ~twice[1];
+		e.hiddenInBox[u] = once[2] & ~twice[2];
+	}
+	return true;
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * One pass over the board with AVX2: 27 ANDs for the candidates of all three
+ * layouts, a nibble-table popcount for the naked singles, and a running
+ * minimum of (count, row, column) keys that SSE4.1's minpos reduces to the
+ * cell with the fewest candidates.
+ */
+__attribute__((target("avx2")))
+bool evaluateAVX2(const VectorBoard& b, Evaluation& e)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi16(1);
+	const __m256i lowNibbles = _mm256_set1_epi8(0x0F);
+	const __m256i lowBytes = _mm256_set1_epi16(0x00FF);
+	const __m256i popcountTable = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i columnKeys = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+	__m256i rowFree = _mm256_load_si256((const __m256i*)b.rowFree);
+	__m256i columnFree = _mm256_load_si256((const __m256i*)b.columnFree);
+	__m256i boxFree = _mm256_load_si256((const __m256i*)b.boxFree);
+
+	// row-major: the column units, plus singles and the best guess.
+	__m256i once = zero;
+	__m256i twice = zero;
+	__m256i dead = zero;
+	__m256i bestKeys = _mm256_set1_epi16(-1);
+	for (int r = 0; r < BOARD_SIZE; r++)
+	{
+		__m256i mask = _mm256_load_si256((const __m256i*)b.rowMajor[r]);
+		__m256i cand = _mm256_and_si256(_mm256_set1_epi16(b.rowFree[r]), columnFree);
+		cand = _mm256_and_si256(cand, _mm256_load_si256((const __m256i*)b.bandBoxes[r / 3]));
+		cand = _mm256_and_si256(cand, mask);
+		_mm256_store_si256((__m256i*)e.candidates[r], cand);
+		twice = _mm256_or_si256(twice, _mm256_and_si256(once, cand));
+		once = _mm256_or_si256(once, cand);
+
+		__m256i filled = _mm256_cmpeq_epi16(mask, zero);
+		__m256i nibbles = _mm256_add_epi8(
+			_mm256_shuffle_epi8(popcountTable, _mm256_and_si256(cand, lowNibbles)),
+			_mm256_shuffle_epi8(popcountTable, _mm256_and_si256(_mm256_srli_epi16(cand, 4), lowNibbles)));
+		__m256i count = _mm256_add_epi16(_mm256_and_si256(nibbles, lowBytes), _mm256_srli_epi16(nibbles, 8));
+
+		dead = _mm256_or_si256(dead, _mm256_andnot_si256(filled, _mm256_cmpeq_epi16(count, zero)));
+		__m256i naked = _mm256_andnot_si256(filled, _mm256_cmpeq_epi16(count, one));
+		e.naked[r] = _mm256_movemask_epi8(naked) & 0x55555555;
+
+		__m256i key = _mm256_or_si256(_mm256_slli_epi16(count, 8), _mm256_or_si256(columnKeys, _mm256_set1_epi16(r << 4)));
+		bestKeys = _mm256_min_epu16(bestKeys, _mm256_or_si256(key, filled));
+	}
+	dead = _mm256_or_si256(dead, _mm256_andnot_si256(once, columnFree));
+	_mm256_store_si256((__m256i*)e.hiddenInColumn, _mm256_andnot_si256(twice, once));
+
+	// column-major: the row units.
+	once = zero;
+	twice = zero;
+	for (int c = 0; c < BOARD_SIZE; c++)
+	{
+		__m256i cand = _mm256_and_si256(_mm256_set1_epi16(b.columnFree[c]), rowFree);
+		cand = _mm256_and_si256(cand, _mm256_load_si256((const __m256i*)b.stackBoxes[c / 3]));
+		cand = _mm256_and_si256(cand, _mm256_load_si256((const __m256i*)b.columnMajor[c]));
+		twice = _mm256_or_si256(twice, _mm256_and_si256(once, cand));
+		once = _mm256_or_si256(once, cand);
+	}
+	dead = _mm256_or_si256(dead, _mm256_andnot_si256(once, rowFree));
+	_mm256_store_si256((__m256i*)e.hiddenInRow, _mm256_andnot_si256(twice, once));
+
+	// box-major: the box units.
+	once = zero;
+	twice = zero;
+	for (int k = 0; k < BOARD_SIZE; k++)
+	{
+		__m256i cand = _mm256_and_si256(boxFree, _mm256_load_si256((const __m256i*)b.boxRows[k / 3]));
+		cand = _mm256_and_si256(cand, _mm256_load_si256((const __m256i*)b.boxColumns[k % 3]));
+		cand = _mm256_and_si256(cand, _mm256_load_si256((const __m256i*)b.boxMajor[k]));
+		twice = _mm256_or_si256(twice, _mm256_and_si256(once, cand));
+		once = _mm256_or_si256(once, cand);
+	}
+	dead = _mm256_or_si256(dead, _mm256_andnot_si256(once, boxFree));
+	_mm256_store_si256((__m256i*)e.hiddenInBox, _mm256_andnot_si256(twice, once));
+
+	if (!_mm256_testz_si256(dead, dead))
+		return false;
+
+	__m128i halves = _mm_min_epu16(_mm256_castsi256_si128(bestKeys), _mm256_extracti128_si256(bestKeys, 1));
+	int bestKey = _mm_cvtsi128_si32(_mm_minpos_epu16(halves)) & 0xFFFF;
+	e.best = (bestKey == 0xFFFF) ? -1 : ((bestKey >> 4) & 15) * BOARD_SIZE + (bestKey & 15);
+	return true;
+}
+#endif
+
+typedef bool (*EvaluateFunction)(const VectorBoard&, Evaluation&);
+
+// Picks the AVX2 pass when the CPU has it.
+EvaluateFunction selectEvaluate()
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return evaluateAVX2;
+#endif
+	return evaluateScalar;
+}
+
+/**
+ * Places the digit in bit into the one cell of a unit that could take it
+ * when the board was evaluated.  Returns false if the digit has lost its
+ * last place since; if the unit got the digit some other way, it's fine.
+ */
+bool placeHidden(VectorBoard& b, VectorTrail& t, const Evaluation& e, int type, int unit, uint16_t bit)
+{
+	uint16_t free = (type == 0) ? b.rowFree[unit] : (type == 1) ? b.columnFree[unit] : b.boxFree[unit];
+	if ((free & bit) == 0)
+		return true;
+
+	for (int k = 0; k < BOARD_SIZE; k++)
+	{
+		int row = (type == 0) ? unit : (type == 1) ? k : (unit / 3) * 3 + k / 3;
+		int col = (type == 0) ? k : (type == 1) ? unit : (unit % 3) * 3 + k % 3;
+		if ((e.candidates[row][col] & bit) == 0)
+			continue;
+		if ((vectorCandidates(b, row, col) & bit) == 0)
+			return false;
+		placeVector(b, t, row * BOARD_SIZE + col, __builtin_ctz(bit) + 1);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Places every single an evaluation found, checking each against the board
+ * as it stands, since an earlier one may have clashed with it.  Returns false
+ * on a clash.
+ */
+bool placeSingles(VectorBoard& b, VectorTrail& t, const Evaluation& e, SolveStats& stats)
+{
+	for (int r = 0; r < BOARD_SIZE; r++)
+	{
+		for (uint32_t naked = e.naked[r]; naked != 0; naked &= naked - 1)
+		{
+			int c = __builtin_ctz(naked) / 2;
+			uint16_t cand = vectorCandidates(b, r, c);
+			if (cand == 0)
+				return false;
+			placeVector(b, t, r * BOARD_SIZE + c, __builtin_ctz(cand) + 1);
+			COUNT(stats.propagations, 1);
+		}
+	}
+
+	for (int u = 0; u < BOARD_SIZE; u++)
+	{
+		const uint16_t hidden[3] = {e.hiddenInRow[u], e.hiddenInColumn[u], e.hiddenInBox[u]};
+		for (int type = 0; type < 3; type++)
+		{
+			for (uint16_t h = hidden[type]; h != 0; h &= h - 1)
+			{
+				int before = t.size;
+				if (!placeHidden(b, t, e, type, u, h & (0 - h)))
+					return false;
+				COUNT(stats.propagations, t.size - before);
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Evaluates and places singles until there are none left, then guesses on
+ * the cell with the fewest candidates.  On failure the board is left as it
+ * was found.
+ */
+bool findSolutionVector(VectorBoard& b, VectorTrail& t, SolveStats& stats, EvaluateFunction evaluate)
+{
+	int mark = t.size;
+	Evaluation e;
+	while (true)
+	{
+		if (!evaluate(b, e))
+		{
+			undoVectorTrail(b, t, mark);
+			return false;
+		}
+		if (b.emptyCells == 0)
+			return true;
+
+		int before = t.size;
+		if (!placeSingles(b, t, e, stats))
+		{
+			undoVectorTrail(b, t, mark);
+			return false;
+		}
+		if (t.size == before)
+			break;
+	}
+
+	int best = e.best;
+	uint16_t cands = e.candidates[cellRow(best)][cellColumn(best)];
+	while (cands != 0)
+	{
+		int guessMark = t.size;
+		stats.guesses++;
+		placeVector(b, t, best, __builtin_ctz(cands) + 1);
+		cands &= cands - 1;
+		if (findSolutionVector(b, t, stats, evaluate))
+			return true;
+		undoVectorTrail(b, t, guessMark);
+		COUNT(stats.backtracks, 1);
+	}
+
+	undoVectorTrail(b, t, mark);
+	return false;
+}
+
+// Solves a bit board with the vector engine and copies the result back.
+bool solveWithVectors(BitBoard& b, SolveStats& stats, EvaluateFunction evaluate)
+{
+	VectorBoard v;
+	VectorTrail t;
+	clearVectorBoard(v);
+	t.size = 0;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if (b.cells[cell] != 0)
+			placeVector(v, t, cell, b.cells[cell]);
+	}
+	if (!findSolutionVector(v, t, stats, evaluate))
+		return false;
+
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if (b.cells[cell] == 0)
+			placeDigit(b, cell, v.cells[cell]);
+	}
+	return true;
+}
+
+/**
+ * Dancing links engine.
+ *
+ * Knuth's Algorithm X on the exact cover form of an n^2 x n^2 sudoku, with
+ * n anywhere from 2 to MAX_BOX_SIZE.  There is a column for every cell, for
+ * every digit in every row, for every digit in every column and for every
+ * digit in every box, and a row for every (cell, digit) choice, covering
+ * one of each.  All the nodes live in one contiguous pool and link to each
+ * other by index: the root first, then the column headers, then four nodes
+ * per choice in choice order, so a node's choice is just its offset.
+ */
+const int MAX_BOX_SIZE = 5;
+const int MAX_GRID_SIZE = MAX_BOX_SIZE * MAX_BOX_SIZE;
+const int MAX_GRID_CELLS = MAX_GRID_SIZE * MAX_GRID_SIZE;
+
+struct DlxNode
+{
+	int left, right, up, down, column;
+};
+
+class DancingLinks
+{
+public:
+	DancingLinks(int newBoxSize);
+	bool load(const uint8_t* grid);
+	void unload();
+	long search(long limit, uint8_t* solution, SolveStats& stats);
+	long searchBelow(const vector<int>& path, long limit, uint8_t* solution, SolveStats& stats);
+	bool expand(vector<int>& path, vector<int>& choices);
+	int boxSize, size, cells;
+	// searches give up as soon as this is raised, if it's set.
+	const atomic<bool>* stop;
+
+private:
+	void cover(int c);
+	void uncover(int c);
+	void selectChoice(int r);
+	void unselectChoice(int r);
+	void replay(const vector<int>& path);
+	void unreplay(const vector<int>& path);
+	int bestColumn();
+	void searchFrom(long limit, uint8_t* solution, SolveStats& stats);
+	int firstChoiceNode;
+	vector<DlxNode> nodes;
+	vector<int> columnSize;
+	vector<int> given;
+	vector<int> chosen;
+	long found;
+};
+
+DancingLinks::DancingLinks(int newBoxSize)
+{
+	boxSize = newBoxSize;
+	size = boxSize * boxSize;
+	cells = size * size;
+
+	int numColumns = 4 * cells;
+	firstChoiceNode = numColumns + 1;
+	nodes.resize(firstChoiceNode + 4 * cells * size);
+	columnSize.assign(numColumns + 1, 0);
+
+	// the root and the column headers form one horizontal list.
+	for (int c = 0; c <= numColumns; c++)
+	{
+		nodes[c].left = (c == 0) ? numColumns : c - 1;
+		nodes[c].right = (c == numColumns) ? 0 : c + 1;
+		nodes[c].up = c;
+		nodes[c].down = c;
+		nodes[c].column = c;
+	}
+
+	for (int cell = 0; cell < cells; cell++)
+	{
+		int row = cell / size;
+		int col = cell % size;
+		int box = (row / boxSize) * boxSize + col / boxSize;
+		for (int d = 0; d < size; d++)
+		{
+			int columns[4] =
+			{
+				1 + cell,
+				1 + cells + row * size + d,
+				1 + 2 * cells + col * size + d,
+				1 + 3 * cells + box * size + d
+			};
+			int base = firstChoiceNode + 4 * (cell * size + d);
+			for (int k = 0; k < 4; k++)
+			{
+				int n = base + k;
+				int c = columns[k];
+				nodes[n].left = base + (k + 3) % 4;
+				nodes[n].right = base + (k + 1) % 4;
+				nodes[n].column = c;
+				nodes[n].up = nodes[c].up;
+				nodes[n].down = c;
+				nodes[nodes[c].up].down = n;
+				nodes[c].up = n;
+				columnSize[c]++;
+			}
+		}
+	}
+	found = 0;
+	stop = 0;
+}
+
+void DancingLinks::cover(int c)
+{
+	nodes[nodes[c].right].left = nodes[c].left;
+	nodes[nodes[c].left].right = nodes[c].right;
+	for (int i = nodes[c].down; i != c; i = nodes[i].down)
+	{
+		for (int j = nodes[i].right; j != i; j = nodes[j].right)
+		{
+			nodes[nodes[j].down].up = nodes[j].up;
+			nodes[nodes[j].up].down = nodes[j].down;
+			columnSize[nodes[j].column]--;
+		}
+	}
+}
+
+void DancingLinks::uncover(int c)
+{
+	for (int i = nodes[c].up; i != c; i = nodes[i].up)
+	{
+		for (int j = nodes[i].left; j != i; j = nodes[j].left)
+		{
+			columnSize[nodes[j].column]++;
+			nodes[nodes[j].down].up = j;
+			nodes[nodes[j].up].down = j;
+		}
+	}
+	nodes[nodes[c].right].left = c;
+	nodes[nodes[c].left].right = c;
+}
+
+// Covers every other column of the choice that node r belongs to.
+void DancingLinks::selectChoice(int r)
+{
+	for (int j = nodes[r].right; j != r; j = nodes[j].right)
+		cover(nodes[j].column);
+}
+
+void DancingLinks::unselectChoice(int r)
+{
+	for (int j = nodes[r].left; j != r; j = nodes[j].left)
+		uncover(nodes[j].column);
+}
+
+/**
+ * Covers the choices of the clues in grid (0 for an empty cell).  Returns
+ * false, with the clues that did go in left loaded, if two of them clash.
+ */
+bool DancingLinks::load(const uint8_t* grid)
+{
+	for (int cell = 0; cell < cells; cell++)
+	{
+		if (grid[cell] == 0)
+			continue;
+		if (grid[cell] > size)
+			return false;
+
+		int r = firstChoiceNode + 4 * (cell * size + grid[cell] - 1);
+		for (int k = 0; k < 4; k++)
+		{
+			// a covered column has been unlinked from its neighbours.
+			int c = nodes[r + k].column;
+			if (nodes[nodes[c].left].right != c)
+				return false;
+		}
+		cover(nodes[r].column);
+		selectChoice(r);
+		given.push_back(r);
+	}
+	return true;
+}
+
+// Takes the clues back out, leaving the links as they were built.
+void DancingLinks::unload()
+{
+	while (!given.empty())
+	{
+		int r = given.back();
+		given.pop_back();
+		unselectChoice(r);
+		uncover(nodes[r].column);
+	}
+}
+
+/**
+ * Searches below the loaded clues until limit solutions have been found, or
+ * all of them if limit is 0, and returns how many were.  The first one is
+ * written to solution along with the clues.
+ */
+long DancingLinks::search(long limit, uint8_t* solution, SolveStats& stats)
+{
+	vector<int> root;
+	return searchBelow(root, limit, solution, stats);
+}
+
+// Makes the choices on path, each of which must still be open, in order.
+void DancingLinks::replay(const vector<int>& path)
+{
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		cover(nodes[path[i]].column);
+		selectChoice(path[i]);
+		chosen.push_back(path[i]);
+	}
+}
+
+void DancingLinks::unreplay(const vector<int>& path)
+{
+	for (size_t i = path.size(); i > 0; i--)
+	{
+		chosen.pop_back();
+		unselectChoice(path[i - 1]);
+		uncover(nodes[path[i - 1]].column);
+	}
+}
+
+/**
+ * Like search, but only below the choices on path, which is how a parallel
+ * search hands out its subtrees.
+ */
+long DancingLinks::searchBelow(const vector<int>& path, long limit, uint8_t* solution, SolveStats& stats)
+{
+	found = 0;
+	chosen.clear();
+	for (size_t i = 0; i < given.size(); i++)
+	{
+		int choice = (given[i] - firstChoiceNode) / 4;
+		solution[choice / size] = choice % size + 1;
+	}
+	replay(path);
+	searchFrom(limit, solution, stats);
+	unreplay(path);
+	return found;
+}
+
+/**
+ * Makes the choices on path, then follows forced choices, appending them to
+ * path, until some column has more than one choice left, and returns those
+ * choices.  choices comes back empty at a dead end or, if this returns
+ * true, because path has become a full solution.
+ */
+bool DancingLinks::expand(vector<int>& path, vector<int>& choices)
+{
+	choices.clear();
+	chosen.clear();
+	replay(path);
+	bool solved = false;
+	while (true)
+	{
+		if (nodes[0].right == 0)
+		{
+			solved = true;
+			break;
+		}
+		int c = bestColumn();
+		if (columnSize[c] == 0)
+			break;
+		if (columnSize[c] > 1)
+		{
+			for (int r = nodes[c].down; r != c; r = nodes[r].down)
+				choices.push_back(r);
+			break;
+		}
+		int r = nodes[c].down;
+		path.push_back(r);
+		cover(c);
+		selectChoice(r);
+		chosen.push_back(r);
+	}
+
+	unreplay(path);
+	return solved;
+}
+
+// Returns the open column with the fewest choices left.
+int DancingLinks::bestColumn()
+{
+	int c = nodes[0].right;
+	for (int j = nodes[c].right; j != 0; j = nodes[j].right)
+	{
+		if (columnSize[j] < columnSize[c])
+			c = j;
+	}
+	return c;
+}
+
+void DancingLinks::searchFrom(long limit, uint8_t* solution, SolveStats& stats)
+{
+	if (stop != 0 && stop->load(memory_order_relaxed))
+		return;
+	if (nodes[0].right == 0)
+	{
+		if (found == 0)
+		{
+			for (size_t i = 0; i < chosen.size(); i++)
+			{
+				int choice = (chosen[i] - firstChoiceNode) / 4;
+				solution[choice / size] = choice % size + 1;
+			}
+		}
+		found++;
+		return;
+	}
+
+	// branch on the column with the fewest choices left.
+	int c = bestColumn();
+	if (columnSize[c] == 0)
+		return;
+
+	bool guessing = columnSize[c] > 1;
+	cover(c);
+	for (int r = nodes[c].down; r != c; r = nodes[r].down)
+	{
+		if (guessing)
+			stats.guesses++;
+		chosen.push_back(r);
+		selectChoice(r);
+		searchFrom(limit, solution, stats);
+		unselectChoice(r);
+		chosen.pop_back();
+		if (limit != 0 && found >= limit)
+			break;
+		if (guessing)
+			COUNT(stats.backtracks, 1);
+	}
+	uncover(c);
+}
+
+/**
+ * Reads a puzzle of any size the dancing links engine handles from one line:
+ * 16, 81, 256 or 625 characters, with '.' or '0' for an empty cell, '1' to
+ * '9' for the digits up to 9 and 'A' onwards for 10 and up.  Returns the box
+ * size, or 0 if the line isn't a puzzle.
+ */
+int parseGridLine(const char* line, size_t length, uint8_t* grid)
+{
+	int boxSize = 2;
+	while (boxSize <= MAX_BOX_SIZE && (size_t)(boxSize * boxSize * boxSize * boxSize) != length)
+		boxSize++;
+	if (boxSize > MAX_BOX_SIZE)
+		return 0;
+
+	int size = boxSize * boxSize;
+	for (size_t i = 0; i < length; i++)
+	{
+		char c = line[i];
+		int val;
+		if (c == '.' || c == '0')
+			val = 0;
+		else if (c >= '1' && c <= '9')
+			val = c - '0';
+		else if (c >= 'A' && c <= 'Z')
+			val = c - 'A' + 10;
+		else if (c >= 'a' && c <= 'z')
+			val = c - 'a' + 10;
+		else
+			return 0;
+		if (val > size)
+			return 0;
+		grid[i] = val;
+	}
+	return boxSize;
+}
+
+// The reverse of parseGridLine for a solved grid.
+void formatGridLine(const uint8_t* grid, int cells, char* out)
+{
+	for (int i = 0; i < cells; i++)
+		out[i] = (grid[i] <= 9) ? '0' + grid[i] : 'A' + grid[i] - 10;
+}
+
+/**
+ * Parallel dancing links.
+ *
+ * A single large puzzle is split across threads by handing out subtrees of
+ * its search as tasks.  A task is the path of choices from the root to its
+ * subtree, and each worker keeps its own dancing links with the clues
+ * loaded, so taking up a task means replaying its path and nothing else is
+ * copied.  Tasks less than splitDepth guesses deep are expanded into one
+ * task per choice at their next guess instead of being searched.  Every
+ * worker pushes and pops tasks at the back of its own queue and, when that
+ * runs dry, steals from the front of another's, where the biggest subtrees
+ * are.  The first worker to find a solution raises a flag that stops all
+ * the others mid-search.
+ */
+const int TASKS_PER_THREAD = 32;
+
+struct DlxTask
+{
+	vector<int> path;
+	int depth;
+};
+
+struct TaskQueue
+{
+	mutex lock;
+	deque<DlxTask> tasks;
+};
+
+struct ParallelSearch
+{
+	int boxSize;
+	const uint8_t* grid;
+	int splitDepth;
+	vector<TaskQueue> queues;
+	// tasks queued or being worked on.
+	atomic<long> pending;
+	atomic<bool> stop;
+	mutex resultLock;
+	uint8_t* solution;
+	bool solved;
+	SolveStats stats;
+};
+
+// Takes a task from the worker's own queue, or else steals one.
+bool takeTask(ParallelSearch* job, int worker, DlxTask& task)
+{
+	int numQueues = job->queues.size();
+	for (int k = 0; k < numQueues; k++)
+	{
+		TaskQueue& queue = job->queues[(worker + k) % numQueues];
+		lock_guard<mutex> lock(queue.lock);
+		if (queue.tasks.empty())
+			continue;
+		if (k == 0)
+		{
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+		}else
+		{
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+void parallelWorker(ParallelSearch* job, int worker)
+{
+	DancingLinks dlx(job->boxSize);
+	dlx.load(job->grid);
+	dlx.stop = &job->stop;
+	SolveStats stats;
+	clearStats(stats);
+	vector<uint8_t> solution(dlx.cells);
+	vector<int> choices;
+
+	while (!job->stop.load())
+	{
+		DlxTask task;
+		if (!takeTask(job, worker, task))
+		{
+			if (job->pending.load() == 0)
+				break;
+			this_thread::yield();
+			continue;
+		}
+
+		bool solved = false;
+		if (task.depth < job->splitDepth)
+		{
+			solved = dlx.expand(task.path, choices);
+			if (solved)
+			{
+				dlx.searchBelow(task.path, 1, &solution[0], stats);
+			}else if (!choices.empty())
+			{
+				stats.guesses += choices.size();
+				job->pending += choices.size();
+				TaskQueue& queue = job->queues[worker];
+				lock_guard<mutex> lock(queue.lock);
+				// pushed in reverse so the first choice is popped first.
+				for (size_t i = choices.size(); i > 0; i--)
+				{
+					DlxTask child;
+					child.path = task.path;
+					child.path.push_back(choices[i - 1]);
+					child.depth = task.depth + 1;
+					queue.tasks.push_back(child);
+				}
+			}
+		}else
+		{
+			solved = dlx.searchBelow(task.path, 1, &solution[0], stats) > 0;
+		}
+
+		if (solved)
+		{
+			lock_guard<mutex> lock(job->resultLock);
+			if (!job->solved)
+			{
+				memcpy(job->solution, &solution[0], dlx.cells);
+				job->solved = true;
+			}
+			job->stop = true;
+		}
+		job->pending--;
+	}
+
+	dlx.unload();
+	lock_guard<mutex> lock(job->resultLock);
+	addStats(job->stats, stats);
+}
+
+/**
+ * Solves an n^2 x n^2 puzzle with box size boxSize on numThreads threads (0
+ * for one per core).  Returns false if it has no solution or its clues
+ * clash.
+ */
+bool solveParallel(int boxSize, const uint8_t* grid, uint8_t* solution, int numThreads, SolveStats& stats)
+{
+	if (numThreads == 0)
+		numThreads = max(1u, thread::hardware_concurrency());
+
+	DancingLinks check(boxSize);
+	if (!check.load(grid))
+		return false;
+
+	ParallelSearch job;
+	job.boxSize = boxSize;
+	job.grid = grid;
+	job.splitDepth = 0;
+	for (int tasks = 1; tasks < numThreads * TASKS_PER_THREAD; tasks *= 2)
+		job.splitDepth++;
+	vector<TaskQueue> queues(numThreads);
+	job.queues.swap(queues);
+	job.pending = 1;
+	job.stop = false;
+	job.solution = solution;
+	job.solved = false;
+	clearStats(job.stats);
+	job.queues[0].tasks.push_back(DlxTask());
+	job.queues[0].tasks.back().depth = 0;
+
+	vector<thread> workers;
+	for (int t = 1; t < numThreads; t++)
+		workers.push_back(thread(parallelWorker, &job, t));
+	parallelWorker(&job, 0);
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+
+	addStats(stats, job.stats);
+	return job.solved;
+}
+
+/**
+ * House engine.
+ *
+ * A house is any set of cells that can't repeat a digit, and a full house,
+ * one of nine cells, must hold every digit once.  Classic rules are the 27
+ * rows, columns and boxes; jigsaw swaps the boxes for irregular regions,
+ * the diagonal variant adds the two long diagonals, and every killer cage
+ * is a house of its own with a sum to meet.  Placing a digit takes it out
+ * of the free mask of each of its cell's houses and off every other cell
+ * in them, so a cell's candidates are just its own mask and the rest of
+ * propagation is singles over full houses and cage pruning.
+ *
+ * A cage with k empty cells and s left to make can only hold digits that
+ * are part of some set of k distinct digits summing to s, using only
+ * digits its cells can still take.  cageCombos lists those sets as masks
+ * for every k and s, so pruning a cage is an OR over a handful of them.
+ *
+ * This is an engine of its own beside BitBoard and propagate, not a
+ * generalization of them: those keep fixed row, column and box masks that
+ * every classic engine and the C interface are tuned around, and taking
+ * them over to house lists would slow all of those down.  The benchmark
+ * checks that the two agree on every classic puzzle it runs.
+ */
+const int MAX_HOUSES = 3 * BOARD_SIZE + 2 + NUM_CELLS;
+const int MAX_CELL_HOUSES = 6;
+const int MAX_CAGES = NUM_CELLS;
+const int MAX_CAGE_SUM = BOARD_SIZE * (BOARD_SIZE + 1) / 2;
+
+struct House
+{
+	int size;
+	int cells[BOARD_SIZE];
+};
+
+struct Cage
+{
+	int sum;
+	int house;
+};
+
+struct Rules
+{
+	int numHouses;
+	House houses[MAX_HOUSES];
+	int numCellHouses[NUM_CELLS];
+	int cellHouses[NUM_CELLS][MAX_CELL_HOUSES];
+	int numCages;
+	Cage cages[MAX_CAGES];
+	int cellCage[NUM_CELLS];
+};
+
+struct HouseBoard
+{
+	uint8_t cells[NUM_CELLS];
+	uint16_t cellMask[NUM_CELLS];
+	uint16_t houseFree[MAX_HOUSES];
+	// what's left of each cage's sum, and its empty cells.
+	int8_t cageSum[MAX_CAGES];
+	uint8_t cageEmpty[MAX_CAGES];
+	int emptyCells;
+};
+
+vector<uint16_t> cageCombos[BOARD_SIZE + 1][MAX_CAGE_SUM + 1];
+
+bool buildCageCombos()
+{
+	for (int mask = 0; mask <= ALL_DIGITS; mask++)
+	{
+		int sum = 0;
+		for (int d = 0; d < BOARD_SIZE; d++)
+		{
+			if (mask & (1 << d))
+				sum += d + 1;
+		}
+		cageCombos[__builtin_popcount(mask)][sum].push_back(mask);
+	}
+	return true;
+}
+
+const bool cageCombosBuilt = buildCageCombos();
+
+void clearRules(Rules& rules)
+{
+	rules.numHouses = 0;
+	rules.numCages = 0;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		rules.numCellHouses[cell] = 0;
+		rules.cellCage[cell] = -1;
+	}
+}
+
+/**
+ * Adds a house of the given cells.  Returns false if there are too many
+ * houses, or too many on one of its cells.
+ */
+bool addHouse(Rules& rules, const int* cells, int size)
+{
+	if (rules.numHouses == MAX_HOUSES || size > BOARD_SIZE)
+		return false;
+	int h = rules.numHouses++;
+	rules.houses[h].size = size;
+	for (int k = 0; k < size; k++)
+	{
+		int cell = cells[k];
+		if (rules.numCellHouses[cell] == MAX_CELL_HOUSES)
+			return false;
+		rules.houses[h].cells[k] = cell;
+		rules.cellHouses[cell][rules.numCellHouses[cell]++] = h;
+	}
+	return true;
+}
+
+// Adds the rows and columns, and the boxes too unless a jigsaw replaces them.
+void addLines(Rules& rules, bool boxes)
+{
+	int cells[BOARD_SIZE];
+	for (int unit = 0; unit < (boxes ? 3 : 2) * BOARD_SIZE; unit++)
+	{
+		for (int k = 0; k < BOARD_SIZE; k++)
+			cells[k] = unitCell(unit, k);
+		addHouse(rules, cells, BOARD_SIZE);
+	}
+}
+
+void addDiagonals(Rules& rules)
+{
+	int down[BOARD_SIZE];
+	int up[BOARD_SIZE];
+	for (int k = 0; k < BOARD_SIZE; k++)
+	{
+		down[k] = k * BOARD_SIZE + k;
+		up[k] = k * BOARD_SIZE + BOARD_SIZE - 1 - k;
+	}
+	addHouse(rules, down, BOARD_SIZE);
+	addHouse(rules, up, BOARD_SIZE);
+}
+
+/**
+ * Adds jigsaw regions from 81 characters, '1' to '9' naming the region of
+ * each cell in reading order.  Returns false unless every region has nine
+ * cells.
+ */
+bool addRegions(Rules& rules, const char* regions)
+{
+	if (strlen(regions) != (size_t)NUM_CELLS)
+		return false;
+	int cells[BOARD_SIZE][BOARD_SIZE];
+	int sizes[BOARD_SIZE] = {0};
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		int r = regions[cell] - '1';
+		if (r < 0 || r >= BOARD_SIZE || sizes[r] == BOARD_SIZE)
+			return false;
+		cells[r][sizes[r]++] = cell;
+	}
+	for (int r = 0; r < BOARD_SIZE; r++)
+	{
+		if (!addHouse(rules, cells[r], BOARD_SIZE))
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Adds killer cages from a map of 81 characters, one per cell in reading
+ * order, where cells sharing a character other than '.' share a cage, and
+ * a comma separated list of their sums, in the order the cages first
+ * appear in the map.  Returns false if they don't match up.
+ */
+bool addCages(Rules& rules, const char* map, const char* sums)
+{
+	if (strlen(map) != (size_t)NUM_CELLS)
+		return false;
+	int cageOf[256];
+	fill(cageOf, cageOf + 256, -1);
+	int cells[MAX_CAGES][BOARD_SIZE];
+	int sizes[MAX_CAGES] = {0};
+	int numCages = 0;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		unsigned char c = map[cell];
+		if (c == '.')
+			continue;
+		if (cageOf[c] < 0)
+			cageOf[c] = numCages++;
+		int cage = cageOf[c];
+		if (sizes[cage] == BOARD_SIZE)
+			return false;
+		cells[cage][sizes[cage]++] = cell;
+	}
+
+	for (int cage = 0; cage < numCages; cage++)
+	{
+		char* end;
+		long sum = strtol(sums, &end, 10);
+		if (end == sums || sum < 1 || sum > MAX_CAGE_SUM || (*end != ',' && *end != '\0'))
+			return false;
+		sums = (*end == ',') ? end + 1 : end;
+
+		int c = rules.numCages++;
+		rules.cages[c].sum = sum;
+		rules.cages[c].house = rules.numHouses;
+		if (!addHouse(rules, cells[cage], sizes[cage]))
+			return false;
+		for (int k = 0; k < sizes[cage]; k++)
+			rules.cellCage[cells[cage][k]] = c;
+	}
+	return *sums == '\0';
+}
+
+void placeHouseDigit(const Rules& rules, HouseBoard& b, int cell, int val)
+{
+	uint16_t bit = 1 << (val - 1);
+	b.cells[cell] = val;
+	b.cellMask[cell] = 0;
+	b.emptyCells--;
+	for (int i = 0; i < rules.numCellHouses[cell]; i++)
+	{
+		int h = rules.cellHouses[cell][i];
+		const House& house = rules.houses[h];
+		b.houseFree[h] &= ~bit;
+		for (int k = 0; k < house.size; k++)
+			b.cellMask[house.cells[k]] &= ~bit;
+	}
+	int cage = rules.cellCage[cell];
+	if (cage >= 0)
+	{
+		b.cageSum[cage] -= val;
+		b.cageEmpty[cage]--;
+	}
+}
+
+/**
+ * Fills b from a puzzle line (see loadBitBoardLine) under the rules.
+ * Returns false if the line is malformed or a clue breaks a rule.
+ */
+bool loadHouseBoard(const Rules& rules, HouseBoard& b, const char* line, size_t length)
+{
+	if (length != (size_t)NUM_CELLS)
+		return false;
+
+	memset(b.cells, 0, sizeof(b.cells));
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+		b.cellMask[cell] = ALL_DIGITS;
+	for (int h = 0; h < rules.numHouses; h++)
+		b.houseFree[h] = ALL_DIGITS;
+	for (int c = 0; c < rules.numCages; c++)
+	{
+		b.cageSum[c] = rules.cages[c].sum;
+		b.cageEmpty[c] = rules.houses[rules.cages[c].house].size;
+	}
+	b.emptyCells = NUM_CELLS;
+
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		char c = line[cell];
+		if (c == '.' || c == '0')
+			continue;
+		if (c < '1' || c > '9')
+			return false;
+		int val = c - '0';
+		if ((b.cellMask[cell] & (1 << (val - 1))) == 0)
+			return false;
+		placeHouseDigit(rules, b, cell, val);
+	}
+	return true;
+}
+
+/**
+ * Narrows every cage's empty cells to the digits of the combinations that
+ * can still make its sum.  Sets changed if anything was taken out, and
+ * returns false if some cage can't be finished.
+ */
+bool pruneCages(const Rules& rules, HouseBoard& b, SolveStats& stats, bool& changed)
+{
+	for (int c = 0; c < rules.numCages; c++)
+	{
+		int empty = b.cageEmpty[c];
+		int sum = b.cageSum[c];
+		if (empty == 0)
+		{
+			if (sum != 0)
+				return false;
+			continue;
+		}
+		if (sum < 1 || sum > MAX_CAGE_SUM)
+			return false;
+
+		const House& house = rules.houses[rules.cages[c].house];
+		uint16_t available = 0;
+		for (int k = 0; k < house.size; k++)
+			available |= b.cellMask[house.cells[k]];
+
+		uint16_t allowed = 0;
+		const vector<uint16_t>& combos = cageCombos[empty][sum];
+		for (size_t i = 0; i < combos.size(); i++)
+		{
+			if ((combos[i] & ~available) == 0)
+				allowed |= combos[i];
+		}
+		if (allowed == 0)
+			return false;
+		if ((available & ~allowed) == 0)
+			continue;
+
+		for (int k = 0; k < house.size; k++)
+		{
+			int cell = house.cells[k];
+			if (b.cells[cell] == 0 && (b.cellMask[cell] & ~allowed) != 0)
+			{
+				b.cellMask[cell] &= allowed;
+				COUNT(stats.propagations, 1);
+				changed = true;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Pushes the board to a fixpoint of naked singles, hidden singles in full
+ * houses and cage pruning.  Returns false on a contradiction.
+ */
+bool propagateHouses(const Rules& rules, HouseBoard& b, SolveStats& stats)
+{
+	while (b.emptyCells > 0)
+	{
+		bool changed = false;
+
+		// naked singles
+		for (int cell = 0; cell < NUM_CELLS; cell++)
+		{
+			if (b.cells[cell] != 0)
+				continue;
+			uint16_t c = b.cellMask[cell];
+			if (c == 0)
+				return false;
+			if ((c & (c - 1)) == 0)
+			{
+				placeHouseDigit(rules, b, cell, __builtin_ctz(c) + 1);
+				COUNT(stats.propagations, 1);
+				changed = true;
+			}
+		}
+		if (changed)
+			continue;
+
+		// hidden singles
+		for (int h = 0; h < rules.numHouses; h++)
+		{
+			const House& house = rules.houses[h];
+			if (house.size != BOARD_SIZE)
+				continue;
+			uint16_t once = 0;
+			uint16_t twice = 0;
+			for (int k = 0; k < BOARD_SIZE; k++)
+			{
+				uint16_t c = b.cellMask[house.cells[k]];
+				twice |= once & c;
+				once |= c;
+			}
+			if ((b.houseFree[h] & ~once) != 0)
+				return false;
+
+			for (uint16_t hidden = once & ~twice; hidden != 0; hidden &= hidden - 1)
+			{
+				uint16_t bit = hidden & (0 - hidden);
+				for (int k = 0; k < BOARD_SIZE; k++)
+				{
+					int cell = house.cells[k];
+					if (b.cellMask[cell] & bit)
+					{
+						placeHouseDigit(rules, b, cell, __builtin_ctz(bit) + 1);
+						COUNT(stats.propagations, 1);
+						changed = true;
+						break;
+					}
+				}
+			}
+		}
+		if (changed)
+			continue;
+
+		if (!pruneCages(rules, b, stats, changed))
+			return false;
+		if (!changed)
+			break;
+	}
+
+	return true;
+}
+
+/**
+ * Solves b, which the caller no longer needs, into out, guessing on the
+ * cell with the fewest candidates on a copy of the board per guess.
+ */
+bool searchHouses(const Rules& rules, HouseBoard& b, SolveStats& stats, uint8_t* out)
+{
+	if (!propagateHouses(rules, b, stats))
+		return false;
+	if (b.emptyCells == 0)
+	{
+		// cage sums are only checked while a cage has room.
+		bool changed = false;
+		if (!pruneCages(rules, b, stats, changed))
+			return false;
+		memcpy(out, b.cells, NUM_CELLS);
+		return true;
+	}
+
+	int best = -1;
+	int bestCount = BOARD_SIZE + 1;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		int count = __builtin_popcount(b.cellMask[cell]);
+		if (b.cells[cell] == 0 && count < bestCount)
+		{
+			best = cell;
+			bestCount = count;
+		}
+	}
+
+	uint16_t cands = b.cellMask[best];
+	while (cands != 0)
+	{
+		int val = __builtin_ctz(cands) + 1;
+		cands &= cands - 1;
+		stats.guesses++;
+
+		HouseBoard child;
+		HouseBoard& guess = (cands != 0) ? child : b;
+		if (cands != 0)
+			child = b;
+		placeHouseDigit(rules, guess, best, val);
+		if (searchHouses(rules, guess, stats, out))
+			return true;
+		COUNT(stats.backtracks, 1);
+	}
+	return false;
+}
+
+Rules makeClassicRules()
+{
+	Rules rules;
+	clearRules(rules);
+	addLines(rules, true);
+	return rules;
+}
+
+const Rules classicRules = makeClassicRules();
+
+/**
+ * Engines that can be picked from the command line.  The bitmask,
+ * propagate, singles and simd engines work on a bit board, and dancing links
+ * on a grid of any size.  singles is the vector engine forced onto its
+ * scalar fallback, and simd is the vector engine on the best path the CPU
+ * has.  copy is the reentrant solver behind the C interface, and houses
+ * is the house engine held to classic rules.  learn is the propagation
+ * engine with nogood learning, dom/wdeg branching and restarts.
+ */
+enum Engine
+{
+	ENGINE_CANDIDATE,
+	ENGINE_BITMASK,
+	ENGINE_PROPAGATE,
+	ENGINE_DLX,
+	ENGINE_SINGLES,
+	ENGINE_SIMD,
+	ENGINE_COPY,
+	ENGINE_HOUSES,
+	ENGINE_LEARN
+};
+
+const char* ENGINE_NAMES[] = {"candidate", "bitmask", "propagate", "dlx", "singles", "simd", "copy", "houses", "learn"};
+const int NUM_ENGINES = sizeof(ENGINE_NAMES) / sizeof(ENGINE_NAMES[0]);
+
+// Returns the engine with the given name, or -1 if there isn't one.
+int parseEngine(const char* name)
+{
+	for (int e = 0; e < NUM_ENGINES; e++)
+	{
+		if (strcmp(name, ENGINE_NAMES[e]) == 0)
+			return e;
+	}
+	return -1;
+}
+
+const EvaluateFunction bestEvaluate = selectEvaluate();
+
+// Solves a bit board in place with one of the bit board engines.
+bool solveBitBoard(BitBoard& b, int engine, SolveStats& stats)
+{
+	if (engine == ENGINE_PROPAGATE)
+	{
+		Trail t;
+		t.size = 0;
+		return findSolutionPropagate(b, t, stats);
+	}
+	if (engine == ENGINE_SINGLES)
+		return solveWithVectors(b, stats, evaluateScalar);
+	if (engine == ENGINE_SIMD)
+		return solveWithVectors(b, stats, bestEvaluate);
+	if (engine == ENGINE_COPY)
+	{
+		SolveOptions options;
+		setDefaultOptions(options);
+		uint8_t out[NUM_CELLS];
+		if (solve(b.cells, out, options, &stats) != SUDOKU_SOLVED)
+			return false;
+		for (int cell = 0; cell < NUM_CELLS; cell++)
+		{
+			if (b.cells[cell] == 0)
+				placeDigit(b, cell, out[cell]);
+		}
+		return true;
+	}
+	if (engine == ENGINE_LEARN)
+		return findSolutionLearning(b, stats);
+	if (engine == ENGINE_HOUSES)
+	{
+		char line[NUM_CELLS];
+		for (int cell = 0; cell < NUM_CELLS; cell++)
+			line[cell] = '0' + b.cells[cell];
+		HouseBoard h;
+		uint8_t out[NUM_CELLS];
+		if (!loadHouseBoard(classicRules, h, line, NUM_CELLS) || !searchHouses(classicRules, h, stats, out))
+			return false;
+		for (int cell = 0; cell < NUM_CELLS; cell++)
+		{
+			if (b.cells[cell] == 0)
+				placeDigit(b, cell, out[cell]);
+		}
+		return true;
+	}
+	return findSolutionBitmask(b, stats);
+}
+
+void loadTestBoard0()
+{
+	int b[][9] =
+	{
+		{0, 2, 0, 4, 5, 6, 7, 8, 9},
+		{4, 5, 6, 7, 8, 9, 1, 2, 3},
+		{7, 0, 0, 0, 2, 3, 0, 5, 6},
+
+		{2, 3, 4, 5, 6, 7, 8, 9, 1},
+		{5, 6, 7, 8, 9, 1, 2, 3, 4},
+		{0, 0, 0, 0, 0, 0, 5, 6, 7},
+
+		{3, 4, 5, 6, 0, 8, 9, 1, 2},
+		{0, 7, 0, 9, 0, 2, 3, 4, 5},
+		{0, 1, 2, 3, 0, 5, 6, 7, 0}
+	};
+
+	for (int j = 0; j < BOARD_SIZE; j++)
+	{
+		for (int i = 0; i < BOARD_SIZE; i++)
+		{
+			board[j][i] = b[j][i];
+		}
+	}
+}
+
+void loadTestBoard1()
+{
+	int b[][9] =
+	{
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{0, 0, 0, 0, 0, 0, 0, 0, 0},
+		{0, 0, 0, 0, 0, 0, 0, 0, 0}
+	};
+
+	for (int j = 0; j < BOARD_SIZE; j++)
+	{
+		for (int i = 0; i < BOARD_SIZE; i++)
+		{
+			board[j][i] = b[j][i];
+		}
+	}
+}
+
+void loadTestBoard2()
+{
+	int b[][9] =
+	{
+		{5, 3, 0, 0, 7, 0, 0, 0, 0},
+		{6, 0, 0, 1, 9, 5, 0, 0, 0},
+		{0, 9, 8, 0, 0, 0, 0, 6, 0},
+
+		{8, 0, 0, 0, 6, 0, 0, 0, 3},
+		{4, 0, 0, 8, 0, 3, 0, 0, 1},
+		{7, 0, 0, 0, 2, 0, 0, 0, 6},
+
+		{0, 6, 0, 0, 0, 0, 2, 8, 0},
+		{0, 0, 0, 4, 1, 9, 0, 0, 5},
+		{0, 0, 0, 0, 8, 0, 0, 7, 9}
+	};
+
+	for (int j = 0; j < BOARD_SIZE; j++)
+	{
+		for (int i = 0; i < BOARD_SIZE; i++)
+		{
+			board[j][i] = b[j][i];
+		}
+	}
+}
+
+void loadTestBoard3()
+{
+	int b[][9] =
+	{
+		{0, 2, 3, 4, 5, 6, 7, 8, 9},
+		{4, 5, 6, 7, 8, 9, 1, 2, 3},
+		{7, 8, 0, 1, 2, 3, 4, 5, 6},
+
+		{2, 3, 4, 5, 6, 7, 8, 9, 1},
+		{5, 6, 7, 8, 9, 1, 2, 3, 4},
+		{8, 9, 1, 2, 3, 4, 5, 6, 7},
+
+		{3, 4, 5, 6, 7, 8, 9, 1, 2},
+		{6, 7, 8, 9, 1, 2, 3, 4, 5},
+		{9, 1, 2, 3, 4, 5, 6, 7, 8}
+	};
+
+	for (int j = 0; j < BOARD_SIZE; j++)
+	{
+		for (int i = 0; i < BOARD_SIZE; i++)
+		{
+			board[j][i] = b[j][i];
+		}
+	}
+}
+
+/**
+ * Fills a bit board from a puzzle in the usual one-line format: 81
+ * characters in reading order, digits for clues and '0' or '.' for empty
+ * cells, with the line ending already trimmed.  Returns false if the line
+ * is malformed, including any other length, or two clues clash.
+ */
+bool loadBitBoardLine(BitBoard& b, const char* line, size_t length)
+{
+	if (length != (size_t)NUM_CELLS)
+		return false;
+
+	clearBitBoard(b);
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		char c = line[cell];
+		if (c == '.' || c == '0')
+			continue;
+		if (c < '1' || c > '9')
+			return false;
+		int val = c - '0';
+		if ((cellCandidates(b, cell) & (1 << (val - 1))) == 0)
+			return false;
+		placeDigit(b, cell, val);
+	}
+	return true;
+}
+
+/**
+ * Canonical forms.
+ *
+ * Relabelling the digits, swapping rows within a band or bands within the
+ * grid, doing the same for columns and stacks, and transposing all turn a
+ * puzzle into an equivalent one, whose solution is the same transformation
+ * of the original's.  Every row and column gets a key that none of those
+ * change: how its empty cells fall across the boxes, and for each clue how
+ * often its digit appears and how many clues its crossing line and box
+ * hold.  The canonical form is the smallest equivalent puzzle in reading
+ * order, with empty cells as 0 and digits relabelled in order of first
+ * appearance, among those whose bands, rows within bands, stacks and
+ * columns within stacks come in order of key, biggest first, and whose
+ * rows outrank its columns.  Since that's a property of the form itself,
+ * every equivalent puzzle has the same one, and the keys usually settle the
+ * order of nearly everything, leaving only ties to search.  The search
+ * chooses rows one at a time (a whole band at a time, then rows within the
+ * band) while carrying along every column arrangement still tied for the
+ * smallest form so far, and drops any row that comes out bigger than the
+ * best found in that position along with everything below it.  That puts a
+ * typical 9x9 puzzle at a few microseconds, well under solving it.
+ */
+const int STACK_ORDERS = 6;
+// marks a row of the best form that hasn't been filled in yet.
+const uint8_t ROW_UNSET = 10;
+
+struct Transform
+{
+	bool transpose;
+	// row i of the canonical form is row rows[i] of the (transposed)
+	// puzzle, likewise for columns.
+	uint8_t rows[BOARD_SIZE];
+	uint8_t columns[BOARD_SIZE];
+	// labels[d] is what digit d becomes.
+	uint8_t labels[BOARD_SIZE + 1];
+};
+
+// A column arrangement still in the running, with the labels it has given out.
+struct Arrangement
+{
+	uint8_t columns[BOARD_SIZE];
+	uint8_t labels[BOARD_SIZE + 1];
+	uint8_t nextLabel;
+};
+
+// The keys of a band's rows or a stack's columns, biggest first.
+struct BandKey
+{
+	uint64_t keys[3];
+
+	bool operator<(const BandKey& other) const
+	{
+		return lexicographical_compare(keys, keys + 3, other.keys, other.keys + 3);
+	}
+
+	bool operator==(const BandKey& other) const
+	{
+		return keys[0] == other.keys[0] && keys[1] == other.keys[1] && keys[2] == other.keys[2];
+	}
+};
+
+struct Canonicalizer
+{
+	uint8_t grid[BOARD_SIZE][BOARD_SIZE];
+	uint8_t best[BOARD_SIZE][BOARD_SIZE];
+	uint64_t rowKeys[BOARD_SIZE];
+	BandKey bandKeys[3];
+	// the column arrangements that put the columns in order of key.
+	vector<Arrangement> ordered;
+	// the arrangements tied after each slot, kept to save reallocating.
+	vector<Arrangement> tied[BOARD_SIZE];
+	Transform current;
+	Transform found;
+};
+
+const int PERMUTATIONS_OF_3[STACK_ORDERS][3] = {{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0}};
+
+/**
+ * Writes row of c.grid to line in a's column order, handing out labels to
+ * digits a hasn't seen yet, and compares it with bound as it goes: returns
+ * 1 as soon as it's bigger, leaving line half done, otherwise 0 if they're
+ * equal or -1 if it's smaller.
+ */
+inline int arrangeRow(const Canonicalizer& c, int row, Arrangement& a, const uint8_t bound[BOARD_SIZE], uint8_t line[BOARD_SIZE])
+{
+	int order = 0;
+	for (int k = 0; k < BOARD_SIZE; k++)
+	{
+		int d = c.grid[row][a.columns[k]];
+		if (d != 0 && a.labels[d] == 0)
+			a.labels[d] = a.nextLabel++;
+		line[k] = a.labels[d];
+		if (order == 0 && line[k] != bound[k])
+		{
+			if (line[k] > bound[k])
+				return 1;
+			order = -1;
+		}
+	}
+	return order;
+}
+
+/**
+ * Works out the key of every line of grid, rows if columns is false: the
+ * empty cells per box sorted, then a sum over the clues mixing how many
+ * times the digit appears with how many clues its crossing line and its box
+ * hold.
+ */
+void lineKeys(const uint8_t grid[BOARD_SIZE][BOARD_SIZE], bool columns, uint64_t keys[BOARD_SIZE])
+{
+	int lineClues[2][BOARD_SIZE] = {{0}};
+	int boxClues[BOARD_SIZE] = {0};
+	int digitClues[BOARD_SIZE + 1] = {0};
+	for (int row = 0; row < BOARD_SIZE; row++)
+	{
+		for (int col = 0; col < BOARD_SIZE; col++)
+		{
+			if (grid[row][col] == 0)
+				continue;
+			lineClues[0][row]++;
+			lineClues[1][col]++;
+			boxClues[(row / 3) * 3 + col / 3]++;
+			digitClues[grid[row][col]]++;
+		}
+	}
+
+	for (int line = 0; line < BOARD_SIZE; line++)
+	{
+		int empties[3] = {3, 3, 3};
+		uint64_t mix = 0;
+		for (int k = 0; k < BOARD_SIZE; k++)
+		{
+			int row = columns ? k : line;
+			int col = columns ? line : k;
+			int d = grid[row][col];
+			if (d == 0)
+				continue;
+			empties[k / 3]--;
+			uint64_t z = (digitClues[d] * 100 + lineClues[columns ? 0 : 1][columns ? row : col] * 10
+				+ boxClues[(row / 3) * 3 + col / 3] + 1) * 0x9e3779b97f4a7c15ULL;
+			mix += (z ^ (z >> 31)) >> 16;
+		}
+		sort(empties, empties + 3);
+		keys[line] = ((uint64_t)(empties[2] * 16 + empties[1] * 4 + empties[0]) << 52) + (mix & ((1ULL << 52) - 1));
+	}
+}
+
+// Gathers the keys of each band's lines, biggest first.
+void bandKeys(const uint64_t keys[BOARD_SIZE], BandKey bands[3])
+{
+	for (int band = 0; band < 3; band++)
+	{
+		for (int k = 0; k < 3; k++)
+			bands[band].keys[k] = keys[band * 3 + k];
+		sort(bands[band].keys, bands[band].keys + 3);
+		swap(bands[band].keys[0], bands[band].keys[2]);
+	}
+}
+
+// The bands' keys, biggest first, for ranking rows against columns.
+vector<BandKey> orientationKey(const BandKey bands[3])
+{
+	vector<BandKey> sorted(bands, bands + 3);
+	sort(sorted.begin(), sorted.end());
+	reverse(sorted.begin(), sorted.end());
+	return sorted;
+}
+
+/**
+ * Lists in c.ordered every column arrangement with the stacks, and the
+ * columns within each, in order of key.
+ */
+void orderColumns(Canonicalizer& c, const uint64_t columnKeys[BOARD_SIZE], const BandKey stacks[3])
+{
+	int withinOrders[3][STACK_ORDERS];
+	int numWithin[3];
+	for (int stack = 0; stack < 3; stack++)
+	{
+		numWithin[stack] = 0;
+		for (int p = 0; p < STACK_ORDERS; p++)
+		{
+			const int* order = PERMUTATIONS_OF_3[p];
+			if (columnKeys[stack * 3 + order[0]] >= columnKeys[stack * 3 + order[1]]
+				&& columnKeys[stack * 3 + order[1]] >= columnKeys[stack * 3 + order[2]])
+				withinOrders[stack][numWithin[stack]++] = p;
+		}
+	}
+
+	c.ordered.clear();
+	for (int s = 0; s < STACK_ORDERS; s++)
+	{
+		const int* order = PERMUTATIONS_OF_3[s];
+		if (stacks[order[0]] < stacks[order[1]] || stacks[order[1]] < stacks[order[2]])
+			continue;
+		for (int i = 0; i < numWithin[order[0]]; i++)
+		{
+			for (int j = 0; j < numWithin[order[1]]; j++)
+			{
+				for (int k = 0; k < numWithin[order[2]]; k++)
+				{
+					int within[3] = {withinOrders[order[0]][i], withinOrders[order[1]][j], withinOrders[order[2]][k]};
+					Arrangement a;
+					for (int n = 0; n < 3; n++)
+					{
+						for (int m = 0; m < 3; m++)
+							a.columns[n * 3 + m] = order[n] * 3 + PERMUTATIONS_OF_3[within[n]][m];
+					}
+					memset(a.labels, 0, sizeof(a.labels));
+					a.nextLabel = 1;
+					c.ordered.push_back(a);
+				}
+			}
+		}
+	}
+}
+
+/**
+ * Chooses rows for positions from slot on, with arrangements holding the
+ * column arrangements tied so far.  An empty list means all of c.ordered,
+ * which is how it starts and stays until a row with a clue is chosen.
+ */
+void canonicalRows(Canonicalizer& c, int slot, const vector<Arrangement>& arrangements, int usedRows, int usedBands)
+{
+	if (slot == BOARD_SIZE)
+	{
+		const Arrangement& a = arrangements.empty() ? c.ordered[0] : arrangements[0];
+		c.found = c.current;
+		memcpy(c.found.columns, a.columns, BOARD_SIZE);
+		memcpy(c.found.labels, a.labels, BOARD_SIZE + 1);
+		return;
+	}
+
+	// only the biggest band left, or the biggest row left in the band, can go next.
+	int firstBand = 0;
+	int lastBand = 2;
+	if (slot % 3 != 0)
+		firstBand = lastBand = c.current.rows[slot - 1] / 3;
+	BandKey biggestBand = {{0, 0, 0}};
+	uint64_t biggestRow = 0;
+	for (int band = firstBand; band <= lastBand; band++)
+	{
+		if (slot % 3 == 0 && (usedBands & (1 << band)) == 0 && biggestBand < c.bandKeys[band])
+			biggestBand = c.bandKeys[band];
+		for (int row = band * 3; row < band * 3 + 3; row++)
+		{
+			if ((usedRows & (1 << row)) == 0)
+				biggestRow = max(biggestRow, c.rowKeys[row]);
+		}
+	}
+
+	vector<Arrangement>& tied = c.tied[slot];
+	for (int band = firstBand; band <= lastBand; band++)
+	{
+		if (slot % 3 == 0 && ((usedBands & (1 << band)) || !(c.bandKeys[band] == biggestBand)))
+			continue;
+		for (int row = band * 3; row < band * 3 + 3; row++)
+		{
+			if ((usedRows & (1 << row)) || (slot % 3 != 0 && c.rowKeys[row] != biggestRow))
+				continue;
+			if (slot % 3 == 0 && c.rowKeys[row] != biggestBand.keys[0])
+				continue;
+
+			// keep the arrangements that make this row smallest, if it can
+			// still tie with the best.
+			uint8_t smallest[BOARD_SIZE];
+			memcpy(smallest, c.best[slot], BOARD_SIZE);
+			tied.clear();
+			bool empty = true;
+			for (int col = 0; col < BOARD_SIZE; col++)
+				empty = empty && c.grid[row][col] == 0;
+			if (empty && arrangements.empty())
+			{
+				// no labels are out yet, so every arrangement is still tied.
+				memset(smallest, 0, BOARD_SIZE);
+			}else
+			{
+				const vector<Arrangement>& from = arrangements.empty() ? c.ordered : arrangements;
+				for (size_t i = 0; i < from.size(); i++)
+				{
+					Arrangement a = from[i];
+					uint8_t line[BOARD_SIZE];
+					int order = arrangeRow(c, row, a, smallest, line);
+					if (order > 0)
+						continue;
+					if (order < 0)
+					{
+						tied.clear();
+						memcpy(smallest, line, BOARD_SIZE);
+					}
+					tied.push_back(a);
+				}
+				if (tied.empty())
+					continue;
+			}
+
+			int order = memcmp(smallest, c.best[slot], BOARD_SIZE);
+			if (order < 0)
+			{
+				memcpy(c.best[slot], smallest, BOARD_SIZE);
+				for (int s = slot + 1; s < BOARD_SIZE; s++)
+					c.best[s][0] = ROW_UNSET;
+			}
+			c.current.rows[slot] = row;
+			canonicalRows(c, slot + 1, tied, usedRows | (1 << row), usedBands | (1 << band));
+		}
+	}
+}
+
+/**
+ * Puts the canonical form of puzzle in canonical, and the transformation
+ * that takes the puzzle there in t.
+ */
+void canonicalize(const uint8_t puzzle[NUM_CELLS], uint8_t canonical[NUM_CELLS], Transform& t)
+{
+	Canonicalizer c;
+	memset(c.best, ROW_UNSET, sizeof(c.best));
+	vector<Arrangement> none;
+
+	// the rows of one orientation are the columns of the other.
+	memcpy(c.grid, puzzle, NUM_CELLS);
+	uint64_t keys[2][BOARD_SIZE];
+	BandKey bands[2][3];
+	lineKeys(c.grid, false, keys[0]);
+	lineKeys(c.grid, true, keys[1]);
+	bandKeys(keys[0], bands[0]);
+	bandKeys(keys[1], bands[1]);
+	vector<BandKey> rank[2] = {orientationKey(bands[0]), orientationKey(bands[1])};
+
+	for (int flip = 0; flip < 2; flip++)
+	{
+		if (rank[flip] < rank[1 - flip])
+			continue;
+		c.current.transpose = (flip == 1);
+		for (int row = 0; row < BOARD_SIZE; row++)
+		{
+			for (int col = 0; col < BOARD_SIZE; col++)
+				c.grid[row][col] = flip ? puzzle[col * BOARD_SIZE + row] : puzzle[row * BOARD_SIZE + col];
+		}
+		memcpy(c.rowKeys, keys[flip], sizeof(c.rowKeys));
+		memcpy(c.bandKeys, bands[flip], sizeof(c.bandKeys));
+		orderColumns(c, keys[1 - flip], bands[1 - flip]);
+		canonicalRows(c, 0, none, 0, 0);
+	}
+
+	// digits the puzzle doesn't use get the labels left over, in order.
+	t = c.found;
+	int next = 1;
+	for (int d = 1; d <= BOARD_SIZE; d++)
+	{
+		if (t.labels[d] != 0)
+			next = max(next, t.labels[d] + 1);
+	}
+	for (int d = 1; d <= BOARD_SIZE; d++)
+	{
+		if (t.labels[d] == 0)
+			t.labels[d] = next++;
+	}
+	memcpy(canonical, c.best, NUM_CELLS);
+}
+
+// Takes a grid in the canonical frame back to the frame of the puzzle t came from.
+void untransform(const Transform& t, const uint8_t in[NUM_CELLS], uint8_t out[NUM_CELLS])
+{
+	uint8_t digits[BOARD_SIZE + 1];
+	digits[0] = 0;
+	for (int d = 1; d <= BOARD_SIZE; d++)
+		digits[t.labels[d]] = d;
+	for (int i = 0; i < BOARD_SIZE; i++)
+	{
+		for (int j = 0; j < BOARD_SIZE; j++)
+		{
+			int row = t.rows[i];
+			int col = t.columns[j];
+			int cell = t.transpose ? col * BOARD_SIZE + row : row * BOARD_SIZE + col;
+			out[cell] = digits[in[i * BOARD_SIZE + j]];
+		}
+	}
+}
+
+/**
+ * Result cache.
+ *
+ * Solutions are kept in an LRU cache under two kinds of key: the puzzle as
+ * it came in, holding its solution as is, and its canonical form, holding
+ * the solution in the canonical frame.  A repeat of a puzzle is a single
+ * hash lookup.  Anything else is canonicalized, so a puzzle that's only
+ * equivalent to one seen before is a hit too, its solution mapped back
+ * through the transformation.  Grids are packed four bits to a cell, and
+ * the cache is split into shards, each with its own lock and its own share
+ * of the capacity, so threads rarely wait on each other.
+ */
+const int CACHE_SHARDS = 16;
+const int PACKED_WORDS = 6;
+
+struct PackedGrid
+{
+	uint64_t words[PACKED_WORDS];
+
+	bool operator==(const PackedGrid& other) const
+	{
+		return memcmp(words, other.words, sizeof(words)) == 0;
+	}
+};
+
+struct PackedGridHash
+{
+	size_t operator()(const PackedGrid& g) const
+	{
+		uint64_t h = 0;
+		for (int i = 0; i < PACKED_WORDS; i++)
+			h = (h ^ g.words[i]) * 0x9e3779b97f4a7c15ULL;
+		return h ^ (h >> 29);
+	}
+};
+
+// The canonical form gets a flag in the spare top bits to keep it apart.
+void packGrid(const uint8_t grid[NUM_CELLS], bool canonical, PackedGrid& g)
+{
+	memset(g.words, 0, sizeof(g.words));
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+		g.words[cell / 16] |= (uint64_t)grid[cell] << (4 * (cell % 16));
+	if (canonical)
+		g.words[PACKED_WORDS - 1] |= 1ULL << 63;
+}
+
+void unpackGrid(const PackedGrid& g, uint8_t grid[NUM_CELLS])
+{
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+		grid[cell] = (g.words[cell / 16] >> (4 * (cell % 16))) & 15;
+}
+
+struct CacheEntry
+{
+	PackedGrid key;
+	PackedGrid solution;
+};
+
+struct CacheShard
+{
+	mutex lock;
+	// most recently used first.
+	list<CacheEntry> entries;
+	unordered_map<PackedGrid, list<CacheEntry>::iterator, PackedGridHash> index;
+};
+
+class ResultCache
+{
+public:
+	ResultCache(size_t capacity);
+	bool find(const PackedGrid& key, PackedGrid& solution);
+	void insert(const PackedGrid& key, const PackedGrid& solution);
+	atomic<long> exactHits, canonicalHits, misses;
+
+private:
+	CacheShard& shardFor(const PackedGrid& key);
+	size_t shardCapacity;
+	CacheShard shards[CACHE_SHARDS];
+};
+
+ResultCache::ResultCache(size_t capacity)
+{
+	shardCapacity = max((size_t)1, capacity / CACHE_SHARDS);
+	exactHits = 0;
+	canonicalHits = 0;
+	misses = 0;
+}
+
+CacheShard& ResultCache::shardFor(const PackedGrid& key)
+{
+	return shards[(PackedGridHash()(key) >> 40) % CACHE_SHARDS];
+}
+
+bool ResultCache::find(const PackedGrid& key, PackedGrid& solution)
+{
+	CacheShard& shard = shardFor(key);
+	lock_guard<mutex> lock(shard.lock);
+	unordered_map<PackedGrid, list<CacheEntry>::iterator, PackedGridHash>::iterator i = shard.index.find(key);
+	if (i == shard.index.end())
+		return false;
+	shard.entries.splice(shard.entries.begin(), shard.entries, i->second);
+	solution = i->second->solution;
+	return true;
+}
+
+void ResultCache::insert(const PackedGrid& key, const PackedGrid& solution)
+{
+	CacheShard& shard = shardFor(key);
+	lock_guard<mutex> lock(shard.lock);
+	if (shard.index.count(key) != 0)
+		return;
+	CacheEntry entry;
+	entry.key = key;
+	entry.solution = solution;
+	shard.entries.push_front(entry);
+	shard.index[key] = shard.entries.begin();
+	if (shard.entries.size() > shardCapacity)
+	{
+		shard.index.erase(shard.entries.back().key);
+		shard.entries.pop_back();
+	}
+}
+
+/**
+ * Solves the puzzle on b with engine, going through the cache first.
+ * Returns false if it has no solution; unsolvable puzzles aren't cached.
+ */
+bool solveCached(ResultCache& cache, BitBoard& b, int engine, SolveStats& stats)
+{
+	PackedGrid key, found;
+	packGrid(b.cells, false, key);
+	uint8_t solution[NUM_CELLS];
+	if (cache.find(key, found))
+	{
+		cache.exactHits++;
+		unpackGrid(found, solution);
+	}else
+	{
+		uint8_t canonical[NUM_CELLS];
+		Transform t;
+		canonicalize(b.cells, canonical, t);
+		PackedGrid canonicalKey;
+		packGrid(canonical, true, canonicalKey);
+		if (cache.find(canonicalKey, found))
+		{
+			cache.canonicalHits++;
+			uint8_t canonicalSolution[NUM_CELLS];
+			unpackGrid(found, canonicalSolution);
+			untransform(t, canonicalSolution, solution);
+		}else
+		{
+			cache.misses++;
+			BitBoard copy = b;
+			if (!solveBitBoard(copy, engine, stats))
+				return false;
+			memcpy(solution, copy.cells, NUM_CELLS);
+
+			// the solution in the canonical frame, by the same transformation.
+			uint8_t canonicalSolution[NUM_CELLS];
+			for (int i = 0; i < BOARD_SIZE; i++)
+			{
+				for (int j = 0; j < BOARD_SIZE; j++)
+				{
+					int row = t.rows[i];
+					int col = t.columns[j];
+					int cell = t.transpose ? col * BOARD_SIZE + row : row * BOARD_SIZE + col;
+					canonicalSolution[i * BOARD_SIZE + j] = t.labels[solution[cell]];
+				}
+			}
+			packGrid(canonicalSolution, true, found);
+			cache.insert(canonicalKey, found);
+		}
+		packGrid(solution, false, found);
+		cache.insert(key, found);
+	}
+
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		if (b.cells[cell] == 0)
+			placeDigit(b, cell, solution[cell]);
+	}
+	return true;
+}
+
+/**
+ * Batch mode.
+ *
+ * Puzzles are read in chunks of BATCH_CHUNK lines.  Every chunk is solved by
+ * one worker thread per core, each pulling blocks of BATCH_BLOCK puzzles off
+ * a shared counter and keeping its own boards and stats on its stack.
+ * Results go into a per-chunk output buffer at a fixed stride per puzzle,
+ * which is then packed down and written out in input order with a single
+ * fwrite.  In solve mode each line gets its solution, or a line of dots if
+ * it has none or is malformed; in count mode it gets its number of solutions
+ * up to the cap.  Counting runs on dancing links with the dlx engine and on
+ * the reentrant solver's counter with any other.  With a result cache,
+ * 9x9 puzzles in solve mode go through it, and its hit rate is reported.
+ */
+const int BATCH_CHUNK = 1 << 16;
+const int BATCH_BLOCK = 64;
+const long BATCH_SOLVE = -1;
+
+struct BatchChunk
+{
+	vector<char> text;
+	vector<size_t> offsets;
+	vector<size_t> lengths;
+	vector<char> output;
+	vector<size_t> outputLengths;
+	size_t stride;
+	int size;
+	int engine;
+	long cap;
+	ResultCache* cache;
+	atomic<int> next;
+	mutex statsLock;
+	SolveStats stats;
+};
+
+/**
+ * Solves (or counts) puzzle i of a chunk into its output slot and records
+ * the length of what was written.  dlx is the worker's dancing links
+ * instance, rebuilt whenever the puzzle size changes.
+ */
+void solveBatchLine(BatchChunk* chunk, int i, DancingLinks*& dlx, SolveStats& stats)
+{
+	const char* puzzle = &chunk->text[chunk->offsets[i]];
+	size_t length = chunk->lengths[i];
+	char* out = &chunk->output[(size_t)i * chunk->stride];
+	size_t n = NUM_CELLS;
+	long found = 0;
+
+	if (chunk->engine == ENGINE_DLX)
+	{
+		uint8_t grid[MAX_GRID_CELLS];
+		uint8_t solution[MAX_GRID_CELLS];
+		int boxSize = parseGridLine(puzzle, length, grid);
+		if (boxSize != 0)
+		{
+			if (dlx == 0 || dlx->boxSize != boxSize)
+			{
+				delete dlx;
+				dlx = new DancingLinks(boxSize);
+			}
+			n = dlx->cells;
+			if (dlx->load(grid))
+				found = dlx->search((chunk->cap == BATCH_SOLVE) ? 1 : chunk->cap, solution, stats);
+			dlx->unload();
+			if (found > 0 && chunk->cap == BATCH_SOLVE)
+				formatGridLine(solution, n, out);
+		}
+	}else if (chunk->cap != BATCH_SOLVE)
+	{
+		BitBoard b;
+		if (loadBitBoardLine(b, puzzle, length))
+		{
+			SolveOptions options;
+			setDefaultOptions(options);
+			found = countCopies(b, options, stats, chunk->cap, 0);
+		}
+	}else
+	{
+		BitBoard b;
+		bool loaded = loadBitBoardLine(b, puzzle, length);
+		if (loaded && (chunk->cache != 0 ? solveCached(*chunk->cache, b, chunk->engine, stats) : solveBitBoard(b, chunk->engine, stats)))
+		{
+			found = 1;
+			for (int cell = 0; cell < NUM_CELLS; cell++)
+				out[cell] = '0' + b.cells[cell];
+		}
+	}
+
+	if (chunk->cap != BATCH_SOLVE)
+		n = sprintf(out, "%ld", found);
+	else if (found == 0)
+		memset(out, '.', n);
+	out[n] = '\n';
+	chunk->outputLengths[i] = n + 1;
+}
+
+void batchWorker(BatchChunk* chunk)
+{
+	SolveStats stats;
+	clearStats(stats);
+	DancingLinks* dlx = 0;
+	while (true)
+	{
+		int start = chunk->next.fetch_add(BATCH_BLOCK);
+		if (start >= chunk->size)
+			break;
+		int end = min(start + BATCH_BLOCK, chunk->size);
+		for (int i = start; i < end; i++)
+		{
+			solveBatchLine(chunk, i, dlx, stats);
+		}
+	}
+	delete dlx;
+
+	lock_guard<mutex> lock(chunk->statsLock);
+	addStats(chunk->stats, stats);
+}
+
+/**
+ * Solves every puzzle in the named file ("-" for stdin), one result per line
+ * on stdout.  cap is BATCH_SOLVE to solve, or else the number of solutions
+ * to stop counting at (0 for no limit).  cacheSize is how many results the
+ * result cache holds when solving, or 0 for no cache.  Throughput and search
+ * statistics go to stderr.
+ */
+int solveBatch(const char* fileName, int engine, long cap, long cacheSize)
+{
+	FILE* in = (strcmp(fileName, "-") == 0) ? stdin : fopen(fileName, "r");
+	if (in == 0)
+	{
+		cerr << "Can't open " << fileName << endl;
+		return -1;
+	}
+
+	unsigned numThreads = thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	BatchChunk chunk;
+	chunk.engine = engine;
+	chunk.cap = cap;
+	chunk.cache = (cacheSize > 0 && cap == BATCH_SOLVE && engine != ENGINE_DLX) ? new ResultCache(cacheSize) : 0;
+	clearStats(chunk.stats);
+	chunk.offsets.resize(BATCH_CHUNK);
+	chunk.lengths.resize(BATCH_CHUNK);
+	chunk.outputLengths.resize(BATCH_CHUNK);
+
+	char* line = 0;
+	size_t capacity = 0;
+	long total = 0;
+	bool done = false;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	while (!done)
+	{
+		// read the next chunk, skipping blank lines.
+		chunk.size = 0;
+		chunk.text.clear();
+		chunk.stride = NUM_CELLS + 1;
+		while (chunk.size < BATCH_CHUNK)
+		{
+			ssize_t length = getline(&line, &capacity, in);
+			if (length < 0)
+			{
+				done = true;
+				break;
+			}
+			while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+				length--;
+			if (length == 0)
+				continue;
+			chunk.offsets[chunk.size] = chunk.text.size();
+			chunk.lengths[chunk.size] = length;
+			chunk.text.insert(chunk.text.end(), line, line + length);
+			chunk.stride = max(chunk.stride, (size_t)length + 1);
+			chunk.size++;
+		}
+		if (chunk.size == 0)
+			break;
+
+		chunk.output.resize(chunk.stride * chunk.size);
+		chunk.next = 0;
+		vector<thread> workers;
+		for (unsigned t = 1; t < numThreads; t++)
+			workers.push_back(thread(batchWorker, &chunk));
+		batchWorker(&chunk);
+		for (size_t t = 0; t < workers.size(); t++)
+			workers[t].join();
+
+		// pack the lines down to the front of the buffer.
+		size_t packed = 0;
+		for (int i = 0; i < chunk.size; i++)
+		{
+			memmove(&chunk.output[packed], &chunk.output[(size_t)i * chunk.stride], chunk.outputLengths[i]);
+			packed += chunk.outputLengths[i];
+		}
+		fwrite(&chunk.output[0], 1, packed, stdout);
+		total += chunk.size;
+	}
+
+	fflush(stdout);
+	free(line);
+	if (in != stdin)
+		fclose(in);
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	cerr << ((cap == BATCH_SOLVE) ? "Solved " : "Counted ") << total << " puzzles in " << seconds << " seconds on "
+		<< numThreads << " threads (" << (seconds > 0 ? total / seconds : 0) << " puzzles/sec)." << endl;
+	printStats(cerr, chunk.stats);
+	if (chunk.cache != 0)
+	{
+		cerr << "Cache: " << chunk.cache->exactHits << " exact hits, " << chunk.cache->canonicalHits
+			<< " canonical hits, " << chunk.cache->misses << " misses" << endl;
+		delete chunk.cache;
+	}
+	return 0;
+}
+
+/**
+ * Generator.
+ *
+ * Every puzzle starts as a random full grid, found by the propagation search
+ * trying candidates in random order.  Clues are then taken out one at a
+ * time in a random order, and a removal is kept only if the puzzle still
+ * has exactly one solution and hasn't become harder than the target grade.
+ * Once no more clues can go the puzzle is graded again, and if it falls
+ * short of the target the whole attempt starts over from a new grid.
+ *
+ * Grades come from what the search needs: easy puzzles fall to singles,
+ * medium ones need locked candidates as well, and hard and expert ones need
+ * guessing, split by how many guesses it takes to prove the solution
+ * unique.  Puzzle i draws all its random numbers from its own stream, seeded
+ * from the run's seed and i, so a seed gives the same puzzles whichever
+ * thread makes each one and however many threads there are.
+ */
+enum Grade { GRADE_EASY, GRADE_MEDIUM, GRADE_HARD, GRADE_EXPERT };
+const char* GRADE_NAMES[] = {"easy", "medium", "hard", "expert"};
+const int NUM_GRADES = sizeof(GRADE_NAMES) / sizeof(GRADE_NAMES[0]);
+const long HARD_GUESSES = 8;
+
+// splitmix64, which is small, fast and fine for shuffling.
+struct Random
+{
+	uint64_t state;
+};
+
+inline uint64_t nextRandom(Random& r)
+{
+	uint64_t z = (r.state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Returns a random number from 0 to n - 1.
+inline int randomBelow(Random& r, int n)
+{
+	return (int)(((nextRandom(r) >> 32) * (uint64_t)n) >> 32);
+}
+
+// Starts the stream for puzzle index of the run seeded with seed.
+void seedRandom(Random& r, uint64_t seed, uint64_t index)
+{
+	r.state = seed ^ (index * 0xd1b54a32d192ed03ULL);
+	r.state = nextRandom(r);
+}
+
+/**
+ * Completes b, which may be empty, into a random full grid.  Returns false
+ * if b has no solution.
+ */
+bool fillRandom(BitBoard& b, Random& r, SolveStats& stats)
+{
+	NoTrail t;
+	if (!propagate(b, t, stats, false))
+		return false;
+	if (b.emptyCells == 0)
+		return true;
+
+	int best = findBestCell(b);
+	uint16_t cands = cellCandidates(b, best);
+	while (cands != 0)
+	{
+		// pick one of the remaining candidates at random.
+		uint16_t bit = cands;
+		for (int k = randomBelow(r, __builtin_popcount(cands)); k > 0; k--)
+			bit &= bit - 1;
+		bit &= 0 - bit;
+		cands ^= bit;
+		stats.guesses++;
+
+		BitBoard child = b;
+		placeDigit(child, best, __builtin_ctz(bit) + 1);
+		if (fillRandom(child, r, stats))
+		{
+			b = child;
+			return true;
+		}
+		COUNT(stats.backtracks, 1);
+	}
+	return false;
+}
+
+/**
+ * Returns the grade of the puzzle in clues, or -1 if it doesn't have
+ * exactly one solution.  Puzzles that fall to propagation alone are unique
+ * without any counting.
+ */
+int gradePuzzle(const uint8_t clues[NUM_CELLS], SolveStats& stats)
+{
+	BitBoard b;
+	if (!loadClues(b, clues))
+		return -1;
+
+	NoTrail t;
+	if (!propagate(b, t, stats, false))
+		return -1;
+	if (b.emptyCells == 0)
+		return GRADE_EASY;
+	if (!propagate(b, t, stats, true))
+		return -1;
+	if (b.emptyCells == 0)
+		return GRADE_MEDIUM;
+
+	SolveOptions options;
+	setDefaultOptions(options);
+	SolveStats local;
+	clearStats(local);
+	long found = countCopies(b, options, local, 2, 0);
+	addStats(stats, local);
+	if (found != 1)
+		return -1;
+	return (local.guesses <= HARD_GUESSES) ? GRADE_HARD : GRADE_EXPERT;
+}
+
+/**
+ * Makes one attempt at a puzzle of the target grade from a new random grid,
+ * leaving it in clues.  Returns the grade it ended up with.
+ */
+int generateAttempt(uint8_t clues[NUM_CELLS], int target, Random& r, SolveStats& stats)
+{
+	BitBoard b;
+	clearBitBoard(b);
+	fillRandom(b, r, stats);
+	memcpy(clues, b.cells, NUM_CELLS);
+
+	int order[NUM_CELLS];
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		int k = randomBelow(r, cell + 1);
+		order[cell] = order[k];
+		order[k] = cell;
+	}
+
+	int grade = GRADE_EASY;
+	for (int k = 0; k < NUM_CELLS; k++)
+	{
+		int cell = order[k];
+		uint8_t val = clues[cell];
+		clues[cell] = 0;
+		int g = gradePuzzle(clues, stats);
+		if (g < 0 || g > target)
+			clues[cell] = val;
+		else
+			grade = g;
+	}
+	return grade;
+}
+
+struct GenerateJob
+{
+	int count;
+	// the grade wanted, or -1 for any.
+	int target;
+	// attempts per puzzle, keeping the one with the fewest clues.
+	int tries;
+	uint64_t seed;
+	atomic<int> next;
+	vector<char> output;
+	mutex statsLock;
+	SolveStats stats;
+	long attempts;
+	long clues;
+};
+
+void generateWorker(GenerateJob* job)
+{
+	SolveStats stats;
+	clearStats(stats);
+	long attempts = 0;
+	long clueCount = 0;
+	while (true)
+	{
+		int i = job->next.fetch_add(1);
+		if (i >= job->count)
+			break;
+
+		Random r;
+		seedRandom(r, job->seed, i);
+		uint8_t clues[NUM_CELLS];
+		uint8_t best[NUM_CELLS];
+		int bestClues = NUM_CELLS + 1;
+		for (int k = 0; k < job->tries; )
+		{
+			attempts++;
+			int grade = generateAttempt(clues, (job->target < 0) ? GRADE_EXPERT : job->target, r, stats);
+			if (job->target >= 0 && grade != job->target)
+				continue;
+			k++;
+			int n = NUM_CELLS - count(clues, clues + NUM_CELLS, 0);
+			if (n < bestClues)
+			{
+				memcpy(best, clues, NUM_CELLS);
+				bestClues = n;
+			}
+		}
+
+		char* out = &job->output[(size_t)i * (NUM_CELLS + 1)];
+		for (int cell = 0; cell < NUM_CELLS; cell++)
+			out[cell] = (best[cell] == 0) ? '.' : '0' + best[cell];
+		out[NUM_CELLS] = '\n';
+		clueCount += bestClues;
+	}
+
+	lock_guard<mutex> lock(job->statsLock);
+	addStats(job->stats, stats);
+	job->attempts += attempts;
+	job->clues += clueCount;
+}
+
+/**
+ * Fills the job's output with count puzzles, one per line, on one thread per
+ * core.  Returns the number of threads used.
+ */
+unsigned runGenerateJob(GenerateJob& job, int count, int target, int tries, uint64_t seed)
+{
+	unsigned numThreads = thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	job.count = count;
+	job.target = target;
+	job.tries = tries;
+	job.seed = seed;
+	job.next = 0;
+	job.output.resize((size_t)count * (NUM_CELLS + 1));
+	clearStats(job.stats);
+	job.attempts = 0;
+	job.clues = 0;
+
+	vector<thread> workers;
+	for (unsigned t = 1; t < numThreads; t++)
+		workers.push_back(thread(generateWorker, &job));
+	generateWorker(&job);
+	for (size_t t = 0; t < workers.size(); t++)
+		workers[t].join();
+	return numThreads;
+}
+
+/**
+ * Writes count puzzles of the target grade to stdout, one per line, made
+ * from seed on one thread per core.  Timing and statistics go to stderr.
+ */
+int generatePuzzles(int count, int target, uint64_t seed)
+{
+	GenerateJob job;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	unsigned numThreads = runGenerateJob(job, count, target, 1, seed);
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	fwrite(job.output.data(), 1, job.output.size(), stdout);
+	fflush(stdout);
+
+	cerr << "Generated " << count << " " << GRADE_NAMES[target] << " puzzles from seed " << seed << " in "
+		<< seconds << " seconds on " << numThreads << " threads (" << (seconds > 0 ? count / seconds : 0)
+		<< " puzzles/sec)." << endl;
+	cerr << "Attempts: " << job.attempts << ", clues per puzzle: " << (count > 0 ? (double)job.clues / count : 0) << endl;
+	return 0;
+}
+
+/**
+ * Benchmark.
+ *
+ * The benchmark times every engine that can be called on its own over a set
+ * of corpora: a reference corpus of well known puzzles (an easy one, some
+ * famous hard ones and a 17-clue minimal one), and three generated from a
+ * fixed seed so every run sees the same puzzles: easy ones, expert ones and
+ * sparse minimal ones, the fewest-clue puzzle from several attempts.  A
+ * corpus can also come from a file instead.  Each puzzle is timed on its
+ * own to give latency percentiles, and every solution is checked by
+ * isValidSolution, which shares no code with the engines.  The house engine
+ * is also checked against propagate puzzle by puzzle, since it solves
+ * classic puzzles with code of its own.  The candidate engine prints as it
+ * solves, so it stays out.
+ */
+const char* BENCH_PUZZLES[] =
+{
+	"003020600900305001001806400008102900700000008006708200002609500800203009005010300",
+	"4.....8.5.3..........7......2.....6.....8.4......1.......6.3.7.5..2.....1.4......",
+	"85...24..72......9..4.........1.7..23.5...9...4...........8..7..17..........36.4.",
+	"..53.....8......2..7..1.5..4....53...1..7...6..32...8..6.5....9..4....3......97..",
+	"8..........36......7..9.2...5...7.......457.....1...3...1....68..85...1..9....4..",
+	"000000010400000000020000000000050407008000300001090000300400200050100000000806000"
+};
+const int NUM_BENCH_PUZZLES = sizeof(BENCH_PUZZLES) / sizeof(BENCH_PUZZLES[0]);
+const uint64_t BENCH_SEED = 2015;
+const int BENCH_CORPUS_SIZE = 100;
+const int BENCH_MINIMAL_TRIES = 8;
+const double BENCH_SECONDS = 0.5;
+
+struct Corpus
+{
+	string name;
+	vector<string> puzzles;
+};
+
+/**
+ * Returns true if solution is a full grid that keeps every clue of puzzle
+ * and has each digit once in every row, column and box.
+ */
+bool isValidSolution(const string& puzzle, const string& solution)
+{
+	if (solution.size() != (size_t)NUM_CELLS)
+		return false;
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+	{
+		char c = puzzle[cell];
+		if (solution[cell] < '1' || solution[cell] > '9' || (c >= '1' && c <= '9' && c != solution[cell]))
+			return false;
+	}
+
+	for (int unit = 0; unit < BOARD_SIZE; unit++)
+	{
+		bool inRow[BOARD_SIZE + 1] = {false};
+		bool inColumn[BOARD_SIZE + 1] = {false};
+		bool inBox[BOARD_SIZE + 1] = {false};
+		for (int k = 0; k < BOARD_SIZE; k++)
+		{
+			int row = solution[unit * BOARD_SIZE + k] - '0';
+			int column = solution[k * BOARD_SIZE + unit] - '0';
+			int box = solution[((unit / 3) * 3 + k / 3) * BOARD_SIZE + (unit % 3) * 3 + k % 3] - '0';
+			if (inRow[row] || inColumn[column] || inBox[box])
+				return false;
+			inRow[row] = inColumn[column] = inBox[box] = true;
+		}
+	}
+	return true;
+}
+
+/**
+ * Solves puzzle with engine, returning the solution or an empty string.
+ * dlx is only used by the dlx engine.
+ */
+string benchSolve(const string& puzzle, int engine, DancingLinks& dlx, SolveStats& stats)
+{
+	uint8_t grid[NUM_CELLS];
+	if (engine == ENGINE_DLX)
+	{
+		if (parseGridLine(puzzle.c_str(), puzzle.size(), grid) != 3)
+			return "";
+		bool solved = dlx.load(grid) && dlx.search(1, grid, stats) == 1;
+		dlx.unload();
+		if (!solved)
+			return "";
+	}else
+	{
+		BitBoard b;
+		if (!loadBitBoardLine(b, puzzle.c_str(), puzzle.size()) || !solveBitBoard(b, engine, stats))
+			return "";
+		memcpy(grid, b.cells, NUM_CELLS);
+	}
+
+	string solution(NUM_CELLS, '0');
+	for (int cell = 0; cell < NUM_CELLS; cell++)
+		solution[cell] += grid[cell];
+	return solution;
+}
+
+// Returns the p'th quantile of sorted, which mustn't be empty.
+double percentile(const vector<double>& sorted, double p)
+{
+	size_t i = (size_t)(p * sorted.size());
+	return sorted[min(i, sorted.size() - 1)];
+}
+
+/**
+ * Times one engine over a corpus, repeating it until BENCH_SECONDS have
+ * passed, and prints a line of results.  Returns the number of puzzles
+ * whose solution failed validation.
+ */
+long benchEngine(const Corpus& corpus, int engine)
+{
+	DancingLinks dlx(3);
+	SolveStats stats;
+	clearStats(stats);
+	vector<double> latencies;
+	long invalid = 0;
+	double seconds = 0;
+	while (seconds < BENCH_SECONDS && !corpus.puzzles.empty())
+	{
+		for (size_t i = 0; i < corpus.puzzles.size(); i++)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			string solution = benchSolve(corpus.puzzles[i], engine, dlx, stats);
+			double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+			latencies.push_back(elapsed);
+			seconds += elapsed;
+			if (!isValidSolution(corpus.puzzles[i], solution))
+				invalid++;
+		}
+	}
+	if (latencies.empty())
+		return 0;
+
+	double solved = latencies.size();
+	sort(latencies.begin(), latencies.end());
+	printf("%-10s %-9s %10.0f %9.1f %9.1f %9.1f %9.2f", corpus.name.c_str(), ENGINE_NAMES[engine],
+		solved / seconds, percentile(latencies, 0.5) * 1e6, percentile(latencies, 0.99) * 1e6,
+		percentile(latencies, 0.999) * 1e6, stats.guesses / solved);
+	if (COUNTERS_ENABLED)
+		printf(" %10.2f %12.1f", stats.backtracks / solved, stats.propagations / solved);
+	else
+		printf(" %10s %12s", "-", "-");
+	printf("%s\n", (invalid > 0) ? "  INVALID" : "");
+	return invalid;
+}
+
+/**
+ * Checks that the house engine agrees with propagate on every puzzle of a
+ * corpus: both solve it or neither does, and where their solutions differ
+ * the puzzle has more than one.  Returns the number that don't agree.
+ */
+long checkHouseParity(const Corpus& corpus)
+{
+	DancingLinks dlx(3);
+	SolveStats stats;
+	clearStats(stats);
+	SolveOptions options;
+	setDefaultOptions(options);
+	options.threads = 1;
+	long mismatches = 0;
+	for (size_t i = 0; i < corpus.puzzles.size(); i++)
+	{
+		const string& puzzle = corpus.puzzles[i];
+		string houses = benchSolve(puzzle, ENGINE_HOUSES, dlx, stats);
+		string propagated = benchSolve(puzzle, ENGINE_PROPAGATE, dlx, stats);
+		if (houses == propagated)
+			continue;
+
+		uint8_t grid[NUM_CELLS];
+		if (houses.empty() || propagated.empty() || parseGridLine(puzzle.c_str(), puzzle.size(), grid) != 3
+			|| countSolutions(grid, 2, options, 0) < 2)
+			mismatches++;
+	}
+	return mismatches;
+}
+
+/**
+ * Benchmarks every engine on the reference and generated corpora, or on one
+ * puzzle per line from a file.  Returns -1 if any solution was invalid or
+ * the house engine disagreed with propagate.
+ */
+int runBenchmark(const char* fileName)
+{
+	vector<Corpus> corpora;
+	if (fileName == 0)
+	{
+		Corpus reference;
+		reference.name = "reference";
+		reference.puzzles.assign(BENCH_PUZZLES, BENCH_PUZZLES + NUM_BENCH_PUZZLES);
+		corpora.push_back(reference);
+
+		const char* names[] = {"easy", "hard", "minimal"};
+		const int grades[] = {GRADE_EASY, GRADE_EXPERT, -1};
+		const int tries[] = {1, 1, BENCH_MINIMAL_TRIES};
+		for (int c = 0; c < 3; c++)
+		{
+			GenerateJob job;
+			runGenerateJob(job, BENCH_CORPUS_SIZE, grades[c], tries[c], BENCH_SEED + c);
+			Corpus corpus;
+			corpus.name = names[c];
+			for (int i = 0; i < BENCH_CORPUS_SIZE; i++)
+				corpus.puzzles.push_back(string(&job.output[(size_t)i * (NUM_CELLS + 1)], NUM_CELLS));
+			corpora.push_back(corpus);
+		}
+	}else
+	{
+		ifstream in(fileName);
+		if (!in)
+		{
+			cerr << "Can't open " << fileName << endl;
+			return -1;
+		}
+		Corpus corpus;
+		corpus.name = "file";
+		string line;
+		BitBoard b;
+		while (getline(in, line))
+		{
+			if (!line.empty() && line[line.size() - 1] == '\r')
+				line.erase(line.size() - 1);
+			if (loadBitBoardLine(b, line.c_str(), line.size()))
+				corpus.puzzles.push_back(line);
+		}
+		corpora.push_back(corpus);
+	}
+
+	cout << "Simd engine on " << ((bestEvaluate == evaluateScalar) ? "its scalar fallback" : "AVX2")
+		<< (COUNTERS_ENABLED ? "" : ", counters compiled out") << ".  Latencies in microseconds." << endl;
+	printf("%-10s %-9s %10s %9s %9s %9s %9s %10s %12s\n", "corpus", "engine", "puzzles/s",
+		"p50", "p99", "p99.9", "guesses", "backtracks", "propagations");
+
+	long invalid = 0;
+	for (size_t c = 0; c < corpora.size(); c++)
+	{
+		for (int engine = ENGINE_CANDIDATE + 1; engine < NUM_ENGINES; engine++)
+			invalid += benchEngine(corpora[c], engine);
+	}
+
+	long mismatches = 0;
+	size_t checked = 0;
+	for (size_t c = 0; c < corpora.size(); c++)
+	{
+		mismatches += checkHouseParity(corpora[c]);
+		checked += corpora[c].puzzles.size();
+	}
+	cout << "Houses and propagate disagree on " << mismatches << " of " << checked << " puzzles." << endl;
+	if (invalid > 0)
+		cout << invalid << " invalid solutions." << endl;
+	return (invalid > 0 || mismatches > 0) ? -1 : 0;
+}
+
+/**
+ * Times every engine over the reference corpus and prints the results as
+ * JSON for the benchmark runner.
+ */
+int runJsonBenchmark()
+{
+	vector<Measurement> results;
+	for (int engine = ENGINE_CANDIDATE + 1; engine < NUM_ENGINES; engine++)
+	{
+		results.push_back(measure("sudoku", ENGINE_NAMES[engine], [engine]()
+		{
+			DancingLinks dlx(3);
+			SolveStats stats;
+			clearStats(stats);
+			for (int i = 0; i < NUM_BENCH_PUZZLES; i++)
+				benchSolve(BENCH_PUZZLES[i], engine, dlx, stats);
+		}, 2, 20));
+	}
+	printJson(stdout, results);
+	return 0;
+}
+
+void printUsage()
+{
+	cout << "Usage:" << endl;
+	cout << "sudoku [engine]" << endl;
+	cout << "to solve the built-in test board, where engine is candidate (the" << endl;
+	cout << "default), bitmask, propagate, dlx, singles, simd, copy, houses or" << endl;
+	cout << "learn, or" << endl;
+	cout << "sudoku batch [-e engine] [-c cap] [-k cache] [file]" << endl;
+	cout << "to solve one puzzle per line from file (default stdin).  The engine" << endl;
+	cout << "is any but candidate (default propagate); only dlx takes 4x4," << endl;
+	cout << "16x16 and 25x25 puzzles.  With -c, print each puzzle's number of" << endl;
+	cout << "solutions instead, stopping at cap (0 for no limit, 2 to check" << endl;
+	cout << "uniqueness).  Counting uses dancing links with -e dlx, and the" << endl;
+	cout << "copy engine's counter with any other engine.  -k keeps the last" << endl;
+	cout << "cache solutions (9x9, not dlx), found again for repeats and for" << endl;
+	cout << "puzzles equivalent under symmetry.  Or" << endl;
+	cout << "sudoku count [-c cap] puzzle" << endl;
+	cout << "to count the solutions of one 81-character puzzle on every core." << endl;
+	cout << "Or" << endl;
+	cout << "sudoku solve [-t threads] puzzle" << endl;
+	cout << "to solve one puzzle of any size on dancing links, split across" << endl;
+	cout << "threads (default one per core).  Or" << endl;
+	cout << "sudoku variant [-x] [-j regions] [-k cages sums] [puzzle]" << endl;
+	cout << "to solve a variant puzzle (default empty) on the house engine: -x" << endl;
+	cout << "adds the diagonals, -j replaces the boxes with jigsaw regions given" << endl;
+	cout << "as 81 region numbers 1-9, and -k adds killer cages given as 81" << endl;
+	cout << "characters, '.' for no cage, with their sums comma separated in order" << endl;
+	cout << "of first appearance.  Or" << endl;
+	cout << "sudoku generate [-n count] [-g grade] [-s seed]" << endl;
+	cout << "to write count (default 1) new puzzles, one per line, of grade easy," << endl;
+	cout << "medium (the default), hard or expert.  The same seed always gives" << endl;
+	cout << "the same puzzles.  Or" << endl;
+	cout << "sudoku bench [file]" << endl;
+	cout << "to time every engine but candidate on built-in and generated corpora," << endl;
+	cout << "or one puzzle per line from file, checking every solution.  Or" << endl;
+	cout << "sudoku bench --json" << endl;
+	cout << "to time them on the reference corpus and print JSON." << endl;
+}
+
+#ifndef SUDOKU_LIBRARY
+int main(int argc, char** argv)
+{
+	if (argc > 1 && strcmp(argv[1], "batch") == 0)
+	{
+		int engine = ENGINE_PROPAGATE;
+		long cap = BATCH_SOLVE;
+		long cacheSize = 0;
+		const char* fileName = "-";
+		int files = 0;
+		for (int a = 2; a < argc; a++)
+		{
+			if (strcmp(argv[a], "-e") == 0 && a + 1 < argc)
+				engine = parseEngine(argv[++a]);
+			else if (strcmp(argv[a], "-c") == 0 && a + 1 < argc)
+				cap = atol(argv[++a]);
+			else if (strcmp(argv[a], "-k") == 0 && a + 1 < argc)
+				cacheSize = atol(argv[++a]);
+			else
+			{
+				fileName = argv[a];
+				files++;
+			}
+		}
+		if (engine <= ENGINE_CANDIDATE || cap < BATCH_SOLVE || cacheSize < 0 || files > 1)
+		{
+			printUsage();
+			return -1;
+		}
+		return solveBatch(fileName, engine, cap, cacheSize);
+	}
+
+	if (argc > 1 && strcmp(argv[1], "count") == 0)
+	{
+		long cap = 0;
+		const char* puzzle = 0;
+		for (int a = 2; a < argc; a++)
+		{
+			if (strcmp(argv[a], "-c") == 0 && a + 1 < argc)
+				cap = atol(argv[++a]);
+			else
+				puzzle = argv[a];
+		}
+		BitBoard b;
+		if (puzzle == 0 || cap < 0 || !loadBitBoardLine(b, puzzle, strlen(puzzle)))
+		{
+			printUsage();
+			return -1;
+		}
+
+		SolveOptions options;
+		setDefaultOptions(options);
+		options.threads = 0;
+		SolveStats stats;
+		clearStats(stats);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		long found = countSolutions(b.cells, cap, options, &stats);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << found << ((cap != 0 && found == cap) ? " or more" : "") << " solutions in " << seconds << " seconds." << endl;
+		printStats(cout, stats);
+		return 0;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "solve") == 0)
+	{
+		int numThreads = 0;
+		const char* puzzle = 0;
+		for (int a = 2; a < argc; a++)
+		{
+			if (strcmp(argv[a], "-t") == 0 && a + 1 < argc)
+				numThreads = atoi(argv[++a]);
+			else
+				puzzle = argv[a];
+		}
+		uint8_t grid[MAX_GRID_CELLS];
+		int boxSize = (puzzle == 0) ? 0 : parseGridLine(puzzle, strlen(puzzle), grid);
+		if (boxSize == 0 || numThreads < 0)
+		{
+			printUsage();
+			return -1;
+		}
+
+		SolveStats stats;
+		clearStats(stats);
+		uint8_t solution[MAX_GRID_CELLS];
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		bool solved = solveParallel(boxSize, grid, solution, numThreads, stats);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (solved)
+		{
+			char line[MAX_GRID_CELLS + 1];
+			int cells = boxSize * boxSize * boxSize * boxSize;
+			formatGridLine(solution, cells, line);
+			line[cells] = '\0';
+			cout << line << endl;
+		}else
+		{
+			cout << "No solution." << endl;
+		}
+		cout << "Took " << seconds << " seconds." << endl;
+		printStats(cout, stats);
+		return solved ? 0 : 1;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "variant") == 0)
+	{
+		Rules rules;
+		clearRules(rules);
+		const char* regions = 0;
+		const char* cages = 0;
+		const char* sums = 0;
+		bool diagonals = false;
+		string puzzle(NUM_CELLS, '.');
+		for (int a = 2; a < argc; a++)
+		{
+			if (strcmp(argv[a], "-x") == 0)
+				diagonals = true;
+			else if (strcmp(argv[a], "-j") == 0 && a + 1 < argc)
+				regions = argv[++a];
+			else if (strcmp(argv[a], "-k") == 0 && a + 2 < argc)
+			{
+				cages = argv[++a];
+				sums = argv[++a];
+			}else
+				puzzle = argv[a];
+		}
+		addLines(rules, regions == 0);
+		if (diagonals)
+			addDiagonals(rules);
+		HouseBoard b;
+		if ((regions != 0 && !addRegions(rules, regions)) || (cages != 0 && !addCages(rules, cages, sums))
+			|| !loadHouseBoard(rules, b, puzzle.c_str(), puzzle.size()))
+		{
+			printUsage();
+			return -1;
+		}
+
+		SolveStats stats;
+		clearStats(stats);
+		uint8_t solution[NUM_CELLS];
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		bool solved = searchHouses(rules, b, stats, solution);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (solved)
+		{
+			char line[NUM_CELLS + 1];
+			formatGridLine(solution, NUM_CELLS, line);
+			line[NUM_CELLS] = '\0';
+			cout << line << endl;
+		}else
+		{
+			cout << "No solution." << endl;
+		}
+		cout << "Took " << seconds << " seconds." << endl;
+		printStats(cout, stats);
+		return solved ? 0 : 1;
+	}
+
+	if (argc > 1 && strcmp(argv[1], "generate") == 0)
+	{
+		int count = 1;
+		int grade = GRADE_MEDIUM;
+		uint64_t seed = chrono::steady_clock::now().time_since_epoch().count();
+		for (int a = 2; a < argc; a++)
+		{
+			if (strcmp(argv[a], "-n") == 0 && a + 1 < argc)
+				count = atoi(argv[++a]);
+			else if (strcmp(argv[a], "-s") == 0 && a + 1 < argc)
+				seed = strtoull(argv[++a], 0, 10);
+			else if (strcmp(argv[a], "-g") == 0 && a + 1 < argc)
+			{
+				a++;
+				for (grade = NUM_GRADES - 1; grade >= 0; grade--)
+				{
+					if (strcmp(argv[a], GRADE_NAMES[grade]) == 0)
+						break;
+				}
+			}else
+				count = -1;
+		}
+		if (count < 0 || grade < 0)
+		{
+			printUsage();
+			return -1;
+		}
+		return generatePuzzles(count, grade, seed);
+	}
+
+	if (argc == 3 && strcmp(argv[1], "bench") == 0 && strcmp(argv[2], "--json") == 0)
+	{
+		return runJsonBenchmark();
+	}
+
+	if (argc > 1 && strcmp(argv[1], "bench") == 0 && argc < 4)
+	{
+		return runBenchmark((argc == 3) ? argv[2] : 0);
+	}
+
+	int engine = (argc == 2) ? parseEngine(argv[1]) : ENGINE_CANDIDATE;
+	if (argc > 2 || engine < 0)
+	{
+		printUsage();
+		return -1;
+	}
+
+	board = new int*[BOARD_SIZE];
+	for (int j = 0; j < BOARD_SIZE; j++)
+	{
+		board[j] = new int[BOARD_SIZE];
+		for (int i = 0; i < BOARD_SIZE; i++)
+		{
+			board[j][i] = 0;
+		}
+	}
+
+	candidates = new int**[BOARD_SIZE];
+	for (int k = 0; k < BOARD_SIZE; k++)
+	{
+		candidates[k] = new int*[BOARD_SIZE];
+		for (int j = 0; j < BOARD_SIZE; j++)
+		{
+			candidates[k][j] = new int[BOARD_SIZE];
+			for (int i = 0; i < BOARD_SIZE; i++)
+			{
+				candidates[k][j][i] = 1;
+			}
+		}
+	}
+
+	loadTestBoard2();
+	updateCandidates();
+
+	/**
+	for (int j = 7; j < BOARD_SIZE; j++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			cout << "Candidates for (" << i << ", " << j << "):" << endl;
+			for (int x = 0; x < BOARD_SIZE; x++)
+			{
+				if (candidates[j][i][x] == 1)
+				{
+					cout << (x + 1) << " ";
+				}else
+				{
+					cout << "X ";
+				}
+			}
+			cout << endl;
+		}
+	}
+	**/
+
+	//findBestGuess();
+	if (engine == ENGINE_CANDIDATE)
+	{
+		findSolution();
+	}else
+	{
+		BitBoard b;
+		SolveStats stats;
+		clearStats(stats);
+		if (engine == ENGINE_DLX)
+		{
+			uint8_t grid[NUM_CELLS];
+			for (int cell = 0; cell < NUM_CELLS; cell++)
+				grid[cell] = board[cellRow(cell)][cellColumn(cell)];
+			DancingLinks dlx(3);
+			if (dlx.load(grid) && dlx.search(1, grid, stats) == 1)
+			{
+				for (int cell = 0; cell < NUM_CELLS; cell++)
+					board[cellRow(cell)][cellColumn(cell)] = grid[cell];
+				printBoard();
+			}
+		}else if (loadBitBoard(b) && solveBitBoard(b, engine, stats))
+		{
+			storeBitBoard(b);
+			printBoard();
+		}
+		printStats(cout, stats);
+	}
+
+	return 0;
+}
+#endif
@@ -0,0 +1,215 @@
+/**
+ * Timing shared by the programs and the benchmark runner: a monotonic
+ * clock, repeated measurements after a warmup, hardware counters through
+ * perf_event_open where the kernel allows them, and the JSON records the
+ * runner reads back.  Everything is inline so each program just includes
+ * this file.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Seconds on a clock that never jumps, from an arbitrary starting point.
+inline double monotonicSeconds()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/**
+ * Counts user-space cycles and instructions for this thread between start
+ * and stop.  Either count is -1 if the kernel won't provide it, which is
+ * the usual case in containers and VMs.
+ */
+class PerfCounters
+{
+public:
+	PerfCounters();
+	~PerfCounters();
+	void start();
+	void stop();
+	long long cycles, instructions;
+
+private:
+	int cycleCounter, instructionCounter;
+};
+
+#ifdef __linux__
+inline int openPerfCounter(uint64_t config)
+{
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+inline long long readPerfCounter(int fd)
+{
+	long long count;
+	if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count))
+		return -1;
+	return count;
+}
+#endif
+
+inline PerfCounters::PerfCounters()
+{
+	cycles = -1;
+	instructions = -1;
+#ifdef __linux__
+	cycleCounter = openPerfCounter(PERF_COUNT_HW_CPU_CYCLES);
+	instructionCounter = openPerfCounter(PERF_COUNT_HW_INSTRUCTIONS);
+#else
+	cycleCounter = -1;
+	instructionCounter = -1;
+#endif
+}
+
+inline PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+	if (cycleCounter >= 0)
+		close(cycleCounter);
+	if (instructionCounter >= 0)
+		close(instructionCounter);
+#endif
+}
+
+inline void PerfCounters::start()
+{
+#ifdef __linux__
+	int counters[2] = {cycleCounter, instructionCounter};
+	for (int i = 0; i < 2; i++)
+	{
+		if (counters[i] >= 0)
+		{
+			ioctl(counters[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(counters[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+inline void PerfCounters::stop()
+{
+#ifdef __linux__
+	int counters[2] = {cycleCounter, instructionCounter};
+	for (int i = 0; i < 2; i++)
+	{
+		if (counters[i] >= 0)
+			ioctl(counters[i], PERF_EVENT_IOC_DISABLE, 0);
+	}
+	cycles = readPerfCounter(cycleCounter);
+	instructions = readPerfCounter(instructionCounter);
+#endif
+}
+
+/**
+ * One benchmark's results.  Times are per repetition, and the counters are
+ * averaged over the repetitions, or -1 if unavailable.
+ */
+struct Measurement
+{
+	std::string program;
+	std::string name;
+	int repetitions;
+	double minSeconds;
+	double medianSeconds;
+	double meanSeconds;
+	long long cycles;
+	long long instructions;
+};
+
+/**
+ * Runs f warmup times untimed, then repetitions times timed one by one.
+ */
+template <typename Function>
+Measurement measure(const char* program, const std::string& name, Function f, int warmup, int repetitions)
+{
+	for (int i = 0; i < warmup; i++)
+		f();
+
+	PerfCounters counters;
+	std::vector<double> times;
+	long long cycles = 0;
+	long long instructions = 0;
+	for (int i = 0; i < repetitions; i++)
+	{
+		counters.start();
+		double start = monotonicSeconds();
+		f();
+		double end = monotonicSeconds();
+		counters.stop();
+		times.push_back(end - start);
+		cycles = (counters.cycles < 0 || cycles < 0) ? -1 : cycles + counters.cycles;
+		instructions = (counters.instructions < 0 || instructions < 0) ? -1 : instructions + counters.instructions;
+	}
+
+	Measurement m;
+	m.program = program;
+	m.name = name;
+	m.repetitions = repetitions;
+	std::sort(times.begin(), times.end());
+	m.minSeconds = times.empty() ? 0 : times[0];
+	m.medianSeconds = times.empty() ? 0 : times[times.size() / 2];
+	m.meanSeconds = 0;
+	for (size_t i = 0; i < times.size(); i++)
+		m.meanSeconds += times[i] / times.size();
+	m.cycles = (cycles < 0 || repetitions == 0) ? -1 : cycles / repetitions;
+	m.instructions = (instructions < 0 || repetitions == 0) ? -1 : instructions / repetitions;
+	return m;
+}
+
+/**
+ * Writes a measurement as a JSON object on one line, which is the form the
+ * runner parses.  Unavailable counters are null.
+ */
+inline void printJsonRecord(FILE* out, const Measurement& m)
+{
+	fprintf(out, "{\"program\": \"%s\", \"name\": \"%s\", \"repetitions\": %d, \"min_ns\": %.0f, "
+		"\"median_ns\": %.0f, \"mean_ns\": %.0f, ", m.program.c_str(), m.name.c_str(), m.repetitions,
+		m.minSeconds * 1e9, m.medianSeconds * 1e9, m.meanSeconds * 1e9);
+	if (m.cycles < 0)
+		fprintf(out, "\"cycles\": null, ");
+	else
+		fprintf(out, "\"cycles\": %lld, ", m.cycles);
+	if (m.instructions < 0)
+		fprintf(out, "\"instructions\": null}");
+	else
+		fprintf(out, "\"instructions\": %lld}", m.instructions);
+}
+
+// Writes measurements as a JSON array, one record per line.
+inline void printJson(FILE* out, const std::vector<Measurement>& results)
+{
+	fprintf(out, "[\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		printJsonRecord(out, results[i]);
+		fprintf(out, (i + 1 < results.size()) ? ",\n" : "\n");
+	}
+	fprintf(out, "]\n");
+}
+
+#endif